@@ -0,0 +1,298 @@
+// Headless batch processing: video in, per-frame blob statistics out.
+// Decoding, filtering and writing run as pipeline stages on separate
+// threads, connected with bounded queues, so throughput is limited by the
+// slowest stage instead of the sum of all stages. Filtering itself is spread
+// over all cores in bands of rows.
+
+#include <cstdio>	// Used for file output
+#include <cstdlib>	// Used for "atoi"
+#include <cstring>	// Used for "strcmp"
+#include <cstdint>	// Used for fixed size binary records
+#include <iostream>	// Used for C++ cerr print statements
+#include <thread>
+#include <chrono>
+
+#include "BatchMode.h"
+#include "HSVFilter.h"
+#include "Blobs.h"
+#include "BoundedQueue.h"
+#include "FramePrefetcher.h"
+#include "ThreadPool.h"
+#include "Detector.h"
+#include "StageTimer.h"
+#include "Buffers.h"
+#include "HeapCounter.h"
+
+using namespace std;
+
+const size_t BATCH_QUEUE_SIZE = 8; // frames buffered between two pipeline stages
+const size_t BATCH_IMAGES = BATCH_QUEUE_SIZE + 2; // frame buffers in flight: queued, decoded and filtered
+
+// a frame travelling through the pipeline
+struct cBatchFrame {
+	int frame;		// frame index in the video, starting from 0
+	cv::Mat image;	// BGR image
+	std::vector<cBlob> blobs;	// blobs found on it
+	std::vector<int> ids;	// their track identities, with --track
+};
+
+// binary output record, one for each blob (host byte order, 32 bytes)
+struct cBlobRecord {
+	int32_t frame;
+	int32_t dia;
+	double area;
+	double x;
+	double y;
+};
+
+// binary output record with the track identity (host byte order, 40 bytes),
+// starting with the same fields as cBlobRecord
+struct cTrackRecord {
+	int32_t frame;
+	int32_t dia;
+	double area;
+	double x;
+	double y;
+	int32_t id;
+	int32_t reserved;
+};
+
+static void printBatchUsage() {
+	cerr << "usage: colorWheelHSV --batch <videofile> H S V rangeH rangeS rangeV [options]" << endl;
+	cerr << "options:" << endl;
+	cerr << "  -o <file>  - write records to file instead of stdout" << endl;
+	cerr << "  --binary   - write binary records (int32 frame, int32 diameter, double area, x, y) instead of CSV" << endl;
+	cerr << "  --largest  - only report the largest blob of each frame (default: all blobs)" << endl;
+	cerr << "  --minarea <pixels> - ignore blobs smaller than this" << endl;
+	cerr << "  --threads <n> - number of threads for filtering (default: one per core)" << endl;
+	cerr << "  --track    - follow blobs from frame to frame and report their identities" << endl;
+	cerr << "  --rescan <frames> - with --track, search the whole frame for new blobs this often (default " << DEFAULT_RESCAN_INTERVAL << ")" << endl;
+	cerr << "  --coarse <stride> - only filter every stride-th pixel of every stride-th row, and the full" << endl;
+	cerr << "               resolution around the hits; small blobs may be missed (not with --track)" << endl;
+	cerr << "  --mindiameter <pixels> - diameter of the smallest blobs that must not be missed by --coarse;" << endl;
+	cerr << "               without --coarse, the largest safe stride is used" << endl;
+	cerr << "  --timers   - print the latency of each processing stage at the end" << endl;
+}
+
+int runBatchMode(int argc, char **argv) {
+	cColor color;
+	const char *outputfile = 0;
+	bool bBinary = false;
+	int iMode = BLOBS_ALL;
+	int minArea = 0;
+	int numthreads = 0;
+	bool bTrack = false;
+	int rescanInterval = DEFAULT_RESCAN_INTERVAL;
+	int coarseStride = 0;
+	int minDiameter = 0;
+
+	// parse command line
+	if (argc < 9) {
+		printBatchUsage();
+		return -1;
+	}
+	const char *inputfile = argv[2];
+	color.H = atoi(argv[3]);
+	color.S = atoi(argv[4]);
+	color.V = atoi(argv[5]);
+	color.rangeH = atoi(argv[6]);
+	color.rangeS = atoi(argv[7]);
+	color.rangeV = atoi(argv[8]);
+	for (int i = 9; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			outputfile = argv[++i];
+		} else if (!strcmp(argv[i], "--binary")) {
+			bBinary = true;
+		} else if (!strcmp(argv[i], "--largest")) {
+			iMode = BLOBS_LARGEST;
+		} else if (!strcmp(argv[i], "--minarea") && i + 1 < argc) {
+			minArea = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			numthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--track")) {
+			bTrack = true;
+		} else if (!strcmp(argv[i], "--rescan") && i + 1 < argc) {
+			rescanInterval = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--coarse") && i + 1 < argc) {
+			coarseStride = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--mindiameter") && i + 1 < argc) {
+			minDiameter = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--timers")) {
+			enableStageTimers(true);
+		} else {
+			cerr << "unknown option: " << argv[i] << endl;
+			printBatchUsage();
+			return -1;
+		}
+	}
+
+	// what the coarse scan may miss
+	if (minDiameter > 0 && coarseStride <= 0) {
+		coarseStride = getCoarseSafeStride(minDiameter);
+	}
+	if (coarseStride > 1 && bTrack) {
+		cerr << "--coarse is ignored with --track" << endl;
+		coarseStride = 0;
+	}
+	if (coarseStride > 1) {
+		cerr << "coarse scan with stride " << coarseStride << ": blobs containing " << coarseStride << "x"
+			<< coarseStride << " pixels (solid round blobs of " << getCoarseSafeDiameter(coarseStride)
+			<< " pixels diameter) are never missed" << endl;
+		if (minDiameter > 0 && coarseStride > getCoarseSafeStride(minDiameter)) {
+			cerr << "warning: blobs of " << minDiameter << " pixels diameter may be missed, use --coarse "
+				<< getCoarseSafeStride(minDiameter) << " or less" << endl;
+		}
+	}
+
+	// open input and output
+	cv::VideoCapture inputvideo;
+	if (!inputvideo.open(inputfile)) {
+		cerr << "error opening input video file " << inputfile << endl;
+		return -1;
+	}
+	FILE *output = stdout;
+	if (outputfile) {
+		output = fopen(outputfile, bBinary ? "wb" : "w");
+		if (!output) {
+			cerr << "error opening output file " << outputfile << endl;
+			return -1;
+		}
+	}
+	if (!bBinary) {
+		fprintf(output, bTrack ? "frame,id,area,x,y,diameter\n" : "frame,area,x,y,diameter\n");
+	}
+
+	cBoundedQueue<cBatchFrame> decoded(BATCH_QUEUE_SIZE), filtered(BATCH_QUEUE_SIZE);
+	cBoundedQueue<cv::Mat> recycled(BATCH_IMAGES); // buffers the filter stage is done with
+	int framecount = 0;
+	long long warmallocations = -1; // image buffer allocations when the buffers are all in use
+	long long warmheap = -1;		// heap allocations			"
+	bool bWriteError = false;
+	double windowfraction = 0; // sum of the parts of the frames filtered at full resolution
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	// stage 1: decode frames
+	thread decoder([&] {
+		cBatchFrame f;
+		for (f.frame = 0; ; f.frame++) {
+			// the previous buffer is still in use downstream, decode into one that is not,
+			// or into a new one until there are enough of them
+			if (!recycled.tryPop(f.image)) f.image = cv::Mat();
+			{
+				STAGE_TIMER("batch.decode");
+				if (!inputvideo.read(f.image) || f.image.empty()) break;
+			}
+			if (!decoded.push(f)) break;
+		}
+		decoded.close();
+	});
+
+	// stage 2: smooth, convert to HSV, filter and extract blobs, in bands on all cores,
+	// or only around the tracked blobs
+	cThreadPool pool;
+	pool.start(numthreads);
+	thread filter([&] {
+		cHSVDetector detector(pool);
+		cDetectorOptions options;
+		options.bSmooth = true;
+		options.iBlobMode = iMode;
+		options.minArea = minArea;
+		options.bTrack = bTrack;
+		options.rescanInterval = rescanInterval;
+		options.coarseStride = coarseStride;
+		detector.setOptions(options);
+		detector.setColor(color);
+		cBatchFrame f;
+		cDetection result;
+		while (decoded.pop(f)) {
+			STAGE_TIMER("batch.filter");
+			detector.detect(f.frame, f.image, cv::Mat(), result);
+			// copied, so that both keep the capacity of their vectors
+			f.blobs = result.blobs;
+			f.ids = result.ids;
+			windowfraction += result.windowfraction;
+			recycled.push(f.image); // never waits, there are no more buffers than it holds
+			f.image = cv::Mat();
+			if (!filtered.push(f)) break;
+		}
+		filtered.close();
+		decoded.close(); // stop decoding if we were stopped early
+	});
+
+	// stage 3 (this thread): write records
+	cBatchFrame f;
+	while (filtered.pop(f)) {
+		STAGE_TIMER("batch.write");
+		const std::vector<cBlob> &blobs = f.blobs;
+		for (unsigned int j = 0; j < blobs.size(); j++) {
+			if (bBinary && bTrack) {
+				cTrackRecord r;
+				r.frame = f.frame;
+				r.dia = blobs[j].dia;
+				r.area = blobs[j].area;
+				r.x = blobs[j].x;
+				r.y = blobs[j].y;
+				r.id = f.ids[j];
+				r.reserved = 0;
+				bWriteError |= (fwrite(&r, sizeof(r), 1, output) != 1);
+			} else if (bBinary) {
+				cBlobRecord r;
+				r.frame = f.frame;
+				r.dia = blobs[j].dia;
+				r.area = blobs[j].area;
+				r.x = blobs[j].x;
+				r.y = blobs[j].y;
+				bWriteError |= (fwrite(&r, sizeof(r), 1, output) != 1);
+			} else if (bTrack) {
+				bWriteError |= (fprintf(output, "%d,%d,%g,%.2f,%.2f,%d\n", f.frame, f.ids[j],
+					blobs[j].area, blobs[j].x, blobs[j].y, blobs[j].dia) < 0);
+			} else {
+				bWriteError |= (fprintf(output, "%d,%g,%.2f,%.2f,%d\n", f.frame,
+					blobs[j].area, blobs[j].x, blobs[j].y, blobs[j].dia) < 0);
+			}
+		}
+		framecount++;
+		if (framecount == (int)(2 * BATCH_IMAGES)) {
+			warmallocations = getAllocationCount();
+			warmheap = getHeapAllocationCount();
+		}
+		if (bWriteError) {
+			cerr << "error writing output!" << endl;
+			filtered.close();
+			break;
+		}
+	}
+	filter.join();
+	decoder.join();
+	// allocations of the run, without those of shutting down
+	long long allocations = getAllocationCount();
+	long long heap = getHeapAllocationCount();
+	pool.stop();
+	if (outputfile) {
+		bWriteError |= (fclose(output) != 0);
+	} else {
+		fflush(output);
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << framecount << " frames processed in " << seconds << " s ("
+		<< (seconds > 0 ? framecount / seconds : 0) << " frames/s)" << endl;
+	if (coarseStride > 1 && framecount > 0) {
+		cerr << "coarse scan: " << 100 * windowfraction / framecount
+			<< "% of the pixels filtered at full resolution on average" << endl;
+	}
+	if (isStageTimerEnabled()) {
+		printStageTimers(cerr);
+	}
+	// debug builds: buffers are only allocated while the pipeline fills up
+	if (warmallocations >= 0) {
+		cerr << allocations - warmallocations << " image buffers allocated after frame "
+			<< 2 * BATCH_IMAGES << " (" << allocations << " in total)" << endl;
+	}
+	if (warmheap >= 0) {
+		cerr << heap - warmheap << " heap blocks allocated after frame "
+			<< 2 * BATCH_IMAGES << " (" << heap << " in total)" << endl;
+	}
+
+	return bWriteError ? -1 : 0;
+}
@@ -0,0 +1,9 @@
+// Headless batch processing: video in, per-frame blob statistics out.
+
+#ifndef BATCHMODE_H
+#define BATCHMODE_H
+
+// run batch mode with the full command line (argv[1] is "--batch"), returns process exit code
+int runBatchMode(int argc, char **argv);
+
+#endif
@@ -0,0 +1,426 @@
+// Headless microbenchmarks of the image kernels on synthetic frames.
+// Reports ns/pixel and frames/s, writes the results as JSON and compares them
+// to a stored baseline, failing if a kernel got slower than a threshold.
+
+#include <cstdio>	// Used for file output
+#include <cstdlib>	// Used for "atof"
+#include <cstring>	// Used for "strcmp"
+#include <iostream>	// Used for C++ cout print statements
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "VersionNo.h"
+#include "HSVFilter.h"
+#include "HSVConvert.h"
+#include "Blobs.h"
+#include "Highlight.h"
+#include "ThreadPool.h"
+#include "TilePipeline.h"
+#include "ColorWheelRenderer.h"
+#include "HSVHistogram.h"
+#include "CpuFeatures.h"
+#include "CoarseScanner.h"
+
+using namespace std;
+
+const double DEFAULT_BENCH_SECONDS = 0.25;	// minimum measuring time of a kernel
+const double DEFAULT_THRESHOLD = 10;		// allowed slowdown against the baseline in percent
+const int BENCH_REPEATS = 5;				// measurements of a kernel, the median is reported
+
+// a synthetic test frame
+class cBenchScene {
+public:
+	string name;		// resolution, blob density and hue setting
+	cv::Mat bgr;		// blurred input frame
+	cv::Mat hsv;		// its HSV version
+	cColor color;		// color to filter
+};
+
+// the result of a kernel on a scene
+class cBenchResult {
+public:
+	string name;
+	double nsPerPixel;
+	double fps;
+};
+
+// Frame with blobsPerMP disks of the filtered color per megapixel on a noisy background
+// of another hue. With bWrap, the filtered hue range wraps around 0/180.
+static void makeScene(cBenchScene &scene, int width, int height, int blobsPerMP, bool bWrap, cv::RNG &rng) {
+	char name[64];
+	snprintf(name, sizeof(name), "%dx%d/%s/%s", width, height,
+		blobsPerMP > 100 ? "dense" : "sparse", bWrap ? "wrap" : "nowrap");
+	scene.name = name;
+	scene.color = cColor();
+	scene.color.H = bWrap ? 2 : 90;
+	scene.color.rangeH = 10;
+
+	// background: the opposite hue, noisy saturation and value
+	cv::Mat hsv(height, width, CV_8UC3);
+	for (int y = 0; y < height; y++) {
+		uchar *p = hsv.ptr<uchar>(y);
+		for (int x = 0; x < width; x++) {
+			p[x*3 + 0] = (uchar)((scene.color.H + 90 + rng.uniform(-20, 20)) % 180);
+			p[x*3 + 1] = (uchar)rng.uniform(0, 256);
+			p[x*3 + 2] = (uchar)rng.uniform(0, 256);
+		}
+	}
+	// blobs of the filtered color
+	int blobs = (int)((double)blobsPerMP * width * height / 1e6) + 1;
+	int maxradius = blobsPerMP > 100 ? 8 : 40;
+	for (int i = 0; i < blobs; i++) {
+		cv::Point center(rng.uniform(0, width), rng.uniform(0, height));
+		cv::circle(hsv, center, rng.uniform(2, maxradius),
+			cv::Scalar(scene.color.H, scene.color.S, scene.color.V), -1);
+	}
+	cv::cvtColor(hsv, scene.bgr, cv::COLOR_HSV2BGR);
+	smoothFrame(scene.bgr, scene.bgr);
+	cv::cvtColor(scene.bgr, scene.hsv, cv::COLOR_BGR2HSV);
+}
+
+// median time of one call of a kernel in seconds
+static double timeKernel(const function<void()> &kernel, double minSeconds) {
+	typedef chrono::steady_clock clock;
+	vector<double> times;
+	kernel(); // warm up caches and allocations
+	// calls per measurement, so that all of them take about minSeconds
+	clock::time_point start = clock::now();
+	kernel();
+	double once = chrono::duration<double>(clock::now() - start).count();
+	int calls = (int)(minSeconds / BENCH_REPEATS / max(once, 1e-9)) + 1;
+	for (int r = 0; r < BENCH_REPEATS; r++) {
+		start = clock::now();
+		for (int i = 0; i < calls; i++) kernel();
+		times.push_back(chrono::duration<double>(clock::now() - start).count() / calls);
+	}
+	sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+// read ns/pixel values from a JSON file written by writeJSON()
+static bool readBaseline(const char *filename, map<string, double> &baseline) {
+	FILE *f = fopen(filename, "r");
+	if (!f) return false;
+	char line[512], name[256];
+	double ns;
+	while (fgets(line, sizeof(line), f)) {
+		const char *p = strstr(line, "\"name\":");
+		const char *q = strstr(line, "\"ns_per_pixel\":");
+		if (p && q && sscanf(p, "\"name\": \"%255[^\"]\"", name) == 1 && sscanf(q, "\"ns_per_pixel\": %lf", &ns) == 1) {
+			baseline[name] = ns;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+static bool writeJSON(const char *filename, const vector<cBenchResult> &results, int threads) {
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+	fprintf(f, "{\n");
+	fprintf(f, "  \"version\": \"%s\",\n", VERSION_FILESTR);
+	fprintf(f, "  \"simd\": \"%s\",\n", getSIMDLevelName(getSIMDLevel()));
+	fprintf(f, "  \"threads\": %d,\n", threads);
+	fprintf(f, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		// one result per line, readBaseline() depends on it
+		fprintf(f, "    {\"name\": \"%s\", \"ns_per_pixel\": %.4f, \"fps\": %.2f}%s\n",
+			results[i].name.c_str(), results[i].nsPerPixel, results[i].fps,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return fclose(f) == 0;
+}
+
+// Compare convertBGRToHSV() with cv::cvtColor on all 2^24 BGR colors, and filterBGRRow()
+// with filterHSVRow() of the cvtColor result for a few colors, on every SIMD level up to
+// the detected one. Returns the number of mismatching pixels.
+static long verifyHSVConversion() {
+	cv::Mat bgr(4096, 4096, CV_8UC3), reference, hsv, mask, referencemask;
+	for (int y = 0; y < bgr.rows; y++) {
+		uchar *p = bgr.ptr<uchar>(y);
+		for (int x = 0; x < bgr.cols; x++) {
+			int i = y * bgr.cols + x;
+			p[x*3 + 0] = (uchar)(i >> 16);
+			p[x*3 + 1] = (uchar)(i >> 8);
+			p[x*3 + 2] = (uchar)i;
+		}
+	}
+	cv::cvtColor(bgr, reference, cv::COLOR_BGR2HSV);
+	// plain, wrapped around 0/180, full saturation range, widest hue range at the limits
+	cColor colors[4];
+	colors[1].H = 2;
+	colors[2].H = 170;
+	colors[2].rangeS = 255;
+	colors[3].H = 0;
+	colors[3].rangeH = 89;
+	colors[3].S = 0;
+	colors[3].V = 255;
+	mask.create(bgr.size(), CV_8UC1);
+	referencemask.create(bgr.size(), CV_8UC1);
+	long total = 0;
+	int top = getSIMDLevel();
+	for (int level = top; level >= SIMD_NONE; level--) {
+		limitSIMDLevel(level);
+		long errors = 0;
+		convertBGRToHSV(bgr, hsv);
+		for (int y = 0; y < bgr.rows; y++) {
+			const uchar *p = hsv.ptr<uchar>(y), *q = reference.ptr<uchar>(y);
+			for (int x = 0; x < bgr.cols; x++) {
+				if (p[x*3] != q[x*3] || p[x*3 + 1] != q[x*3 + 1] || p[x*3 + 2] != q[x*3 + 2]) errors++;
+			}
+		}
+		for (int c = 0; c < 4; c++) {
+			cHSVLimits limits(colors[c]);
+			for (int y = 0; y < bgr.rows; y++) {
+				filterBGRRow(mask.ptr<uchar>(y), bgr.ptr<uchar>(y), bgr.cols, limits);
+				filterHSVRow(referencemask.ptr<uchar>(y), reference.ptr<uchar>(y), bgr.cols, limits);
+				const uchar *p = mask.ptr<uchar>(y), *q = referencemask.ptr<uchar>(y);
+				for (int x = 0; x < bgr.cols; x++) {
+					if (p[x] != q[x]) errors++;
+				}
+			}
+		}
+		printf("%-8s %ld mismatching pixels\n", getSIMDLevelName(level), errors);
+		fflush(stdout);
+		total += errors;
+	}
+	limitSIMDLevel(top);
+	return total;
+}
+
+// Compare smoothFrame() with cv::GaussianBlur on a random frame, on the whole frame and on
+// submatrices of it (which read the pixels around them), on every SIMD level up to the
+// detected one. Returns the number of mismatching pixels.
+static long verifySmoothing() {
+	cv::Mat bgr(477, 643, CV_8UC3), reference, smoothed, rowbuffer;
+	cv::RNG rng(1);
+	for (int y = 0; y < bgr.rows; y++) {
+		uchar *p = bgr.ptr<uchar>(y);
+		for (int x = 0; x < bgr.cols * 3; x++) p[x] = (uchar)rng.uniform(0, 256);
+	}
+	// whole frame, a band, a region inside, regions at the corners, single rows and columns
+	const cv::Rect rects[] = { cv::Rect(0, 0, 643, 477), cv::Rect(0, 100, 643, 37), cv::Rect(101, 53, 77, 91),
+		cv::Rect(0, 0, 40, 30), cv::Rect(603, 447, 40, 30), cv::Rect(0, 200, 643, 1), cv::Rect(321, 0, 1, 477) };
+	long total = 0;
+	int top = getSIMDLevel();
+	for (int level = top; level >= SIMD_NONE; level--) {
+		limitSIMDLevel(level);
+		long errors = 0;
+		for (size_t r = 0; r < sizeof(rects) / sizeof(rects[0]); r++) {
+			cv::Mat roi = bgr(rects[r]);
+			cv::GaussianBlur(roi, reference, cv::Size(3, 3), 0);
+			smoothFrame(roi, smoothed, rowbuffer);
+			for (int y = 0; y < roi.rows; y++) {
+				const uchar *p = smoothed.ptr<uchar>(y), *q = reference.ptr<uchar>(y);
+				for (int x = 0; x < roi.cols * 3; x += 3) {
+					if (p[x] != q[x] || p[x + 1] != q[x + 1] || p[x + 2] != q[x + 2]) errors++;
+				}
+			}
+		}
+		printf("%-8s %ld mismatching blurred pixels\n", getSIMDLevelName(level), errors);
+		fflush(stdout);
+		total += errors;
+	}
+	limitSIMDLevel(top);
+	return total;
+}
+
+static void printBenchUsage() {
+	cerr << "usage: colorWheelHSV_bench [options]" << endl;
+	cerr << "options:" << endl;
+	cerr << "  --json <file>       - write results to a JSON file" << endl;
+	cerr << "  --baseline <file>   - compare with the results of an earlier run, fail on slowdown" << endl;
+	cerr << "  --threshold <pct>   - allowed slowdown against the baseline (default " << DEFAULT_THRESHOLD << "%)" << endl;
+	cerr << "  --time <seconds>    - minimum measuring time of each kernel (default " << DEFAULT_BENCH_SECONDS << ")" << endl;
+	cerr << "  --filter <text>     - only run kernels whose name contains this" << endl;
+	cerr << "  --threads <n>       - number of threads for the tile pipeline (default: one per core)" << endl;
+	cerr << "  --verify            - check the HSV conversion against cv::cvtColor on all BGR colors, and the" << endl;
+	cerr << "                        blur against cv::GaussianBlur, and exit" << endl;
+}
+
+int main(int argc, char **argv) {
+	const char *jsonfile = 0;
+	const char *baselinefile = 0;
+	const char *filter = "";
+	double threshold = DEFAULT_THRESHOLD;
+	double seconds = DEFAULT_BENCH_SECONDS;
+	int numthreads = 0;
+	bool bVerify = false;
+
+	// parse command line
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+			jsonfile = argv[++i];
+		} else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+			baselinefile = argv[++i];
+		} else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+			filter = argv[++i];
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			numthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--verify")) {
+			bVerify = true;
+		} else {
+			printBenchUsage();
+			return -1;
+		}
+	}
+	if (bVerify) {
+		long errors = verifyHSVConversion();
+		if (errors) {
+			cerr << "the HSV conversion differs from cv::cvtColor!" << endl;
+		}
+		long blurerrors = verifySmoothing();
+		if (blurerrors) {
+			cerr << "the blur differs from cv::GaussianBlur!" << endl;
+		}
+		return (errors || blurerrors) ? 1 : 0;
+	}
+	map<string, double> baseline;
+	if (baselinefile && !readBaseline(baselinefile, baseline)) {
+		cerr << "error reading baseline file " << baselinefile << endl;
+		return -1;
+	}
+
+	cThreadPool pool;
+	pool.start(numthreads);
+	cTilePipeline pipeline(pool);
+	cCoarseScanner coarse(pool);
+	cHSVLookupTable lookuptable;
+	cBlobExtractor extractor;
+	cColorWheelRenderer wheelrenderer;
+	cHSVHistogram histogram;
+	vector<cBenchResult> results;
+	bool bFailed = false;
+	cv::RNG rng(12345);
+
+	cout << "colorWheelHSV_bench " << VERSION_FILESTR << ", SIMD: " << getSIMDLevelName(getSIMDLevel())
+		<< ", threads: " << pool.size() << endl;
+
+	// measure a kernel, print and compare its result
+	function<void(const string &, double, const function<void()> &)> run =
+		[&](const string &name, double pixels, const function<void()> &kernel) {
+		if (name.find(filter) == string::npos) return;
+		cBenchResult r;
+		double t = timeKernel(kernel, seconds);
+		r.name = name;
+		r.nsPerPixel = t * 1e9 / pixels;
+		r.fps = 1 / t;
+		results.push_back(r);
+		printf("%-44s %9.3f ns/pixel %10.1f frames/s", name.c_str(), r.nsPerPixel, r.fps);
+		map<string, double>::const_iterator it = baseline.find(name);
+		if (it != baseline.end() && it->second > 0) {
+			double change = (r.nsPerPixel / it->second - 1) * 100;
+			printf(" %+7.1f%%", change);
+			if (change > threshold) {
+				printf(" SLOWER");
+				bFailed = true;
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+	};
+
+	// the color wheel does not depend on the input
+	{
+		cColor color;
+		vector<cColor> colorvec(4);
+		cv::Mat image;
+		run("colorwheel/361x306", WIDTH * HEIGHT, [&] {
+			color.H = (color.H + 1) % HUE_RANGE;	// a new hue every time
+			wheelrenderer.render(image, color, colorvec);
+		});
+	}
+
+	// image kernels on all scenes
+	const int sizes[][2] = { {640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160} };
+	const int densities[] = { 10, 2000 };	// blobs per megapixel
+	for (int s = 0; s < 4; s++) {
+		for (int d = 0; d < 2; d++) {
+			for (int w = 0; w < 2; w++) {
+				cBenchScene scene;
+				makeScene(scene, sizes[s][0], sizes[s][1], densities[d], w == 1, rng);
+				double pixels = (double)scene.bgr.rows * scene.bgr.cols;
+				cv::Mat hsv, mask, output, smoothed;
+				vector<cBlob> blobs;
+				cvFilterHSV(mask, scene.hsv, scene.color);
+
+				run("cvtColor/" + scene.name, pixels, [&] {
+					cv::cvtColor(scene.bgr, hsv, cv::COLOR_BGR2HSV);
+				});
+				run("convertHSV/" + scene.name, pixels, [&] {
+					convertBGRToHSV(scene.bgr, hsv);
+				});
+				run("GaussianBlur/" + scene.name, pixels, [&] {
+					cv::GaussianBlur(scene.bgr, smoothed, cv::Size(3, 3), 0);
+				});
+				cv::Mat rowbuffer;
+				run("smoothFrame/" + scene.name, pixels, [&] {
+					smoothFrame(scene.bgr, smoothed, rowbuffer);
+				});
+				cHSVLimits limits(scene.color);
+				run("filterBGR/" + scene.name, pixels, [&] {
+					for (int y = 0; y < scene.bgr.rows; y++) {
+						filterBGRRow(mask.ptr<uchar>(y), scene.bgr.ptr<uchar>(y), scene.bgr.cols, limits);
+					}
+				});
+				run("cvFilterHSV/" + scene.name, pixels, [&] {
+					cvFilterHSV(mask, scene.hsv, scene.color);
+				});
+				lookuptable.update(scene.color);
+				run("lookuptable/" + scene.name, pixels, [&] {
+					lookuptable.filter(mask, scene.bgr);
+				});
+				run("highlight_white/" + scene.name, pixels, [&] {
+					HighlightMask(scene.bgr, mask, output, 3);
+				});
+				run("highlight_red/" + scene.name, pixels, [&] {
+					HighlightMask(scene.bgr, mask, output, 2);
+				});
+				run("blobs/" + scene.name, pixels, [&] {
+					extractor.extract(mask, blobs, BLOBS_ALL);
+				});
+				output = scene.bgr.clone();
+				run("drawblobs/" + scene.name, pixels, [&] {
+					DrawBlobs(mask, output, &scene.color, BLOBS_ALL);
+				});
+				run("histogram/" + scene.name, pixels, [&] {
+					histogram.build(scene.hsv, pool);
+				});
+				pipeline.bSmooth = true;
+				pipeline.iHighlightChannel = 3;
+				pipeline.iBlobMode = BLOBS_ALL;
+				run("pipeline/" + scene.name, pixels, [&] {
+					pipeline.process(scene.bgr, cv::Mat(), scene.color, smoothed, mask, output, blobs);
+				});
+				coarse.pipeline.bSmooth = true;
+				run("coarse/" + scene.name, pixels, [&] {
+					coarse.scan(scene.bgr, scene.color, blobs);
+				});
+			}
+		}
+	}
+	int threads = pool.size();
+	pool.stop();
+
+	if (jsonfile && !writeJSON(jsonfile, results, threads)) {
+		cerr << "error writing " << jsonfile << endl;
+		return -1;
+	}
+	if (bFailed) {
+		cerr << "some kernels are more than " << threshold << "% slower than the baseline!" << endl;
+		return 1;
+	}
+	return 0;
+}
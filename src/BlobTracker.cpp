@@ -0,0 +1,135 @@
+// Frame-to-frame blob tracking with predicted search windows.
+
+#include <cstdio>	// Used for "snprintf"
+#include <algorithm>
+
+#include "BlobTracker.h"
+#include "StageTimer.h"
+
+cBlobTracker::cBlobTracker(cThreadPool &pool)
+	:pipeline(pool), rescanInterval(DEFAULT_RESCAN_INTERVAL), margin(DEFAULT_TRACK_MARGIN)
+	,maxMissed(DEFAULT_MAX_MISSED), nextid(0), framesSinceScan(0), bFullScan(false)
+{
+	pipeline.iBlobMode = BLOBS_ALL;
+	pipeline.bKeepSmoothed = false; // only the blobs are used
+}
+
+void cBlobTracker::reset() {
+	tracks.clear();
+	framesSinceScan = 0;
+}
+
+// bounding box of the blob where it is expected on the next frame, with a margin
+// growing with the number of frames it has been missing
+cv::Rect cBlobTracker::getSearchWindow(const cTrack &track, const cv::Size &size) const {
+	const cv::Rect &b = track.blob.bbox;
+	int steps = track.missed + 1;
+	int m = margin * steps + std::max(b.width, b.height) / 4;
+	int x = b.x + (int)floor(track.vx * steps + 0.5);
+	int y = b.y + (int)floor(track.vy * steps + 0.5);
+	cv::Rect w(x - m, y - m, b.width + 2 * m, b.height + 2 * m);
+	return w & cv::Rect(0, 0, size.width, size.height);
+}
+
+// Filter and label the search windows only. Returns false if they still cut blobs after
+// a few rounds of growing them.
+bool cBlobTracker::scanWindows(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs) {
+	STAGE_TIMER("track.windows");
+	windows.clear();
+	for (size_t t = 0; t < tracks.size(); t++) {
+		windows.push_back(getSearchWindow(tracks[t], srcBGR.size()));
+	}
+	return pipeline.processWindows(srcBGR, color, windows, margin, blobs);
+}
+
+void cBlobTracker::scanFrame(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs) {
+	STAGE_TIMER("track.scan");
+	pipeline.process(srcBGR, cv::Mat(), color, smoothed, mask, highlight, blobs);
+}
+
+// Match blobs to the tracks, nearest to the predicted position first, within the
+// search windows. Returns false if a blob seen on the previous frame is lost.
+// With bApply, the tracks are updated and unmatched blobs start new tracks.
+bool cBlobTracker::associate(const std::vector<cBlob> &blobs, const cv::Size &size, bool bApply) {
+	// candidate pairs by squared distance from the prediction
+	pairs.clear();
+	for (int t = 0; t < (int)tracks.size(); t++) {
+		const cTrack &track = tracks[t];
+		cv::Rect w = getSearchWindow(track, size);
+		int steps = track.missed + 1;
+		double px = track.blob.x + track.vx * steps;
+		double py = track.blob.y + track.vy * steps;
+		for (int b = 0; b < (int)blobs.size(); b++) {
+			if (!w.contains(cv::Point((int)blobs[b].x, (int)blobs[b].y))) continue;
+			double dx = blobs[b].x - px, dy = blobs[b].y - py;
+			pairs.push_back(std::make_pair(dx * dx + dy * dy, std::make_pair(t, b)));
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+	matches.assign(tracks.size(), -1);
+	used.assign(blobs.size(), false);
+	for (size_t i = 0; i < pairs.size(); i++) {
+		int t = pairs[i].second.first, b = pairs[i].second.second;
+		if (matches[t] >= 0 || used[b]) continue;
+		matches[t] = b;
+		used[b] = true;
+	}
+	bool bLost = false;
+	for (size_t t = 0; t < tracks.size(); t++) {
+		if (matches[t] < 0 && !tracks[t].missed) bLost = true;
+	}
+	if (!bApply) return !bLost;
+
+	// update tracks, velocity is smoothed over frames
+	for (size_t t = 0; t < tracks.size(); t++) {
+		cTrack &track = tracks[t];
+		track.age++;
+		if (matches[t] < 0) {
+			track.missed++;
+			continue;
+		}
+		const cBlob &blob = blobs[matches[t]];
+		int steps = track.missed + 1;
+		track.vx = (track.vx + (blob.x - track.blob.x) / steps) / 2;
+		track.vy = (track.vy + (blob.y - track.blob.y) / steps) / 2;
+		track.blob = blob;
+		track.missed = 0;
+	}
+	// forget blobs missing for too long
+	for (size_t t = tracks.size(); t-- > 0; ) {
+		if (tracks[t].missed > maxMissed) tracks.erase(tracks.begin() + t);
+	}
+	// new blobs
+	for (size_t b = 0; b < blobs.size(); b++) {
+		if (!used[b]) tracks.push_back(cTrack(nextid++, blobs[b]));
+	}
+	return !bLost;
+}
+
+void cBlobTracker::track(const cv::Mat &srcBGR, const cColor &color) {
+	STAGE_TIMER("track");
+	// the first frame after reset() is always scanned
+	bFullScan = (framesSinceScan == 0 || framesSinceScan >= rescanInterval);
+	if (!bFullScan) {
+		// a lost blob may have moved farther than predicted, or disappeared
+		bFullScan = !scanWindows(srcBGR, color, frameblobs) || !associate(frameblobs, srcBGR.size(), false);
+	}
+	if (bFullScan) {
+		scanFrame(srcBGR, color, frameblobs);
+		framesSinceScan = 0;
+	}
+	framesSinceScan++;
+	associate(frameblobs, srcBGR.size(), true);
+}
+
+void DrawTrack(cv::Mat &dstImg, const cTrack &track) {
+	const cBlob &blob = track.blob;
+	cv::Point center((int)blob.x, (int)blob.y);
+	cv::circle(dstImg, center, blob.dia, cv::Scalar(0, 255, 255), 2);
+	// where it is heading in the next 10 frames
+	cv::line(dstImg, center, cv::Point((int)(blob.x + track.vx * 10), (int)(blob.y + track.vy * 10)),
+		cv::Scalar(0, 255, 255), 2);
+	char c[32];
+	snprintf(c, 32, "#%d A:%d", track.id, int(blob.area));
+	cv::putText(dstImg, c, cv::Point(center.x + blob.dia + 5, center.y), cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 255, 255), 2);
+}
@@ -0,0 +1,77 @@
+// Frame-to-frame blob tracking with predicted search windows.
+
+#ifndef BLOBTRACKER_H
+#define BLOBTRACKER_H
+
+#include <vector>
+#include <utility>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "Blobs.h"
+#include "ThreadPool.h"
+#include "TilePipeline.h"
+
+const int DEFAULT_RESCAN_INTERVAL = 30;	// frames between two scans of the whole frame
+const int DEFAULT_TRACK_MARGIN = 16;	// search window margin around the predicted blob in pixels
+const int DEFAULT_MAX_MISSED = 5;		// frames a blob may be missing before it is forgotten
+
+// a blob followed over frames
+class cTrack {
+public:
+	int id;			// identity, unique within a tracker
+	cBlob blob;		// last measurement
+	double vx, vy;	// velocity in pixels/frame
+	int age;		// frames since it was first seen
+	int missed;		// frames since it was last seen, 0 if it is on the current frame
+	//! Constructor.
+	cTrack(int id, const cBlob &blob)
+		:id(id),blob(blob),vx(0),vy(0),age(0),missed(0)
+	{}
+};
+
+// Follows the blobs of a color over the frames of a video. On each frame only the
+// search windows around the predicted positions of the known blobs are filtered and
+// labeled, so the cost scales with the number of blobs instead of the image size.
+// The whole frame is scanned for new blobs every rescanInterval frames, and whenever
+// a blob is lost.
+class cBlobTracker {
+public:
+	cTilePipeline pipeline;	// filters the windows; set bSmooth, lookuptable and minArea on it
+	int rescanInterval;		// scan the whole frame at least this often (1 = every frame)
+	int margin;				// search window margin around the predicted blob in pixels
+	int maxMissed;			// forget blobs missing for more than this many frames
+	//! Constructor.
+	explicit cBlobTracker(cThreadPool &pool);
+	// find the tracked blobs of a color on the next frame of the video
+	void track(const cv::Mat &srcBGR, const cColor &color);
+	// forget all blobs, the next frame is scanned as a whole
+	void reset();
+	// blobs followed now, including the ones missing on the current frame
+	const std::vector<cTrack> &getTracks() const { return tracks; }
+	// was the whole frame scanned on the last call of track()?
+	bool wasFullScan() const { return bFullScan; }
+private:
+	cv::Rect getSearchWindow(const cTrack &track, const cv::Size &size) const;
+	bool scanWindows(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs);
+	void scanFrame(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs);
+	bool associate(const std::vector<cBlob> &blobs, const cv::Size &size, bool bApply);
+	std::vector<cTrack> tracks;
+	std::vector<cv::Rect> windows;
+	std::vector<int> matches;	// blob index for each track, -1 if none
+	// reused from frame to frame
+	std::vector<cBlob> frameblobs;	// blobs found on the frame
+	std::vector<std::pair<double, std::pair<int, int> > > pairs;	// (distance, (track, blob)) candidates
+	std::vector<bool> used;		// blobs matched to a track
+	cv::Mat smoothed, mask, highlight;	// outputs of whole frame scans
+	int nextid;
+	int framesSinceScan;
+	bool bFullScan;
+};
+
+// draw a tracked blob with its identity and velocity
+void DrawTrack(cv::Mat &dstImg, const cTrack &track);
+
+#endif
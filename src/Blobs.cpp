@@ -0,0 +1,324 @@
+// Blob detection on binary filter images.
+
+#include <cstdio>	// Used for "snprintf"
+#include <algorithm>
+
+#include "Blobs.h"
+
+void cBlobStats::addRun(int y, int x0, int x1) {
+	int64_t m = x1 - x0;
+	int64_t a = x0 - 1, b = x1 - 1;
+	int64_t sumx = (a + b + 1) * m / 2;
+	int64_t sumxx = b*(b+1)*(2*b+1)/6 - a*(a+1)*(2*a+1)/6;
+	n += m;
+	sx += sumx;
+	sy += m * y;
+	sxx += sumxx;
+	sxy += sumx * y;
+	syy += m * y * y;
+	if (x0 < xmin) xmin = x0;
+	if (x1 - 1 > xmax) xmax = x1 - 1;
+	if (y < ymin) ymin = y;
+	if (y > ymax) {
+		ymax = y;
+		xlast = x0;
+	} else if (y == ymax && x0 < xlast) {
+		xlast = x0;
+	}
+}
+
+void cBlobStats::merge(const cBlobStats &other) {
+	n += other.n;
+	sx += other.sx;
+	sy += other.sy;
+	sxx += other.sxx;
+	sxy += other.sxy;
+	syy += other.syy;
+	if (other.xmin < xmin) xmin = other.xmin;
+	if (other.xmax > xmax) xmax = other.xmax;
+	if (other.ymin < ymin) ymin = other.ymin;
+	if (other.ymax > ymax) {
+		ymax = other.ymax;
+		xlast = other.xlast;
+	} else if (other.ymax == ymax && other.xlast < xlast) {
+		xlast = other.xlast;
+	}
+}
+
+cBlob::cBlob(const cBlobStats &stats)
+	:area((double)stats.n)
+	,x((double)stats.sx / stats.n)
+	,y((double)stats.sy / stats.n)
+	,dia((int)(sqrt(area / 3.14159265) * 2))
+	,bbox(stats.xmin, stats.ymin, stats.xmax - stats.xmin + 1, stats.ymax - stats.ymin + 1)
+	,mu20((double)stats.sxx - stats.sx * x)
+	,mu11((double)stats.sxy - stats.sx * y)
+	,mu02((double)stats.syy - stats.sy * y)
+{}
+
+cBlobExtractor::cBlobExtractor()
+	:output(0), bands(1), mode(BLOBS_NONE), minarea(0)
+{}
+
+int cBlobExtractor::find(int label) {
+	while (parent[label] != label) {
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+// join two components given by their roots, returns the new root
+int cBlobExtractor::unite(int a, int b) {
+	if (a == b) return a;
+	stats[a].merge(stats[b]);
+	first[a] |= first[b];
+	parent[b] = a;
+	return a;
+}
+
+// a component is complete, or open at the band border; remap[] tells which
+void cBlobExtractor::finish(int label, bool bOpen) {
+	const cBlobStats &s = stats[label];
+	if (bOpen) {
+		remap[label] = -3 - (int)output->open.size();
+		output->open.push_back(s);
+		return;
+	}
+	remap[label] = -2;
+	if (s.n < minarea) return;
+	if (mode == BLOBS_ALL) {
+		output->complete.push_back(s);
+	} else if (output->complete.empty()) {
+		output->complete.push_back(s);
+	} else if (s.n > output->complete[0].n) {
+		output->complete[0] = s;
+	}
+}
+
+void cBlobExtractor::extract(const cv::Mat &srcBin, std::vector<cBlob> &blobs, int iMode, int minArea) {
+	blobs.clear();
+	// do not find anything on 0
+	if (iMode == BLOBS_NONE) {
+		return;
+	}
+	extractBand(srcBin, 0, bands[0], iMode, minArea);
+	merger.merge(bands, blobs, iMode, minArea);
+}
+
+void cBlobExtractor::extractBand(const cv::Mat &srcBin, int y0, cBlobBand &band, int iMode, int minArea) {
+	CV_Assert(srcBin.type() == CV_8UC1);
+	output = &band;
+	mode = iMode;
+	minarea = minArea;
+	band.complete.clear();
+	band.open.clear();
+	band.firstrow.clear();
+	band.lastrow.clear();
+	prevruns.clear();
+	stats.clear();
+	first.clear();
+	parent.clear();
+	if (iMode == BLOBS_NONE) {
+		return;
+	}
+
+	// one more empty row at the end finishes all remaining components
+	for (int r = 0; r <= srcBin.rows; r++) {
+		int y = y0 + r;
+		size_t i, j, k;
+
+		// collect the runs of this row
+		runs.clear();
+		if (r < srcBin.rows) {
+			const uchar *p = srcBin.ptr<uchar>(r);
+			int x = 0, w = srcBin.cols;
+			while (x < w) {
+				while (x < w && !p[x]) x++;
+				if (x == w) break;
+				cBlobRun run;
+				run.x0 = x;
+				while (x < w && p[x]) x++;
+				run.x1 = x;
+				run.label = -1;
+				runs.push_back(run);
+			}
+		}
+
+		// connect them to the runs of the previous row they touch, also diagonally
+		for (i = 0, j = 0; i < runs.size(); i++) {
+			cBlobRun &run = runs[i];
+			while (j < prevruns.size() && prevruns[j].x1 < run.x0) j++;
+			for (k = j; k < prevruns.size() && prevruns[k].x0 <= run.x1; k++) {
+				int l = find(prevruns[k].label);
+				run.label = (run.label < 0) ? l : unite(run.label, l);
+			}
+			if (run.label < 0) {
+				run.label = (int)stats.size();
+				stats.push_back(cBlobStats());
+				first.push_back(r == 0);
+				parent.push_back(run.label);
+			}
+			stats[run.label].addRun(y, run.x0, run.x1);
+		}
+
+		// number the components that continue in this row
+		int count = 0;
+		remap.assign(stats.size(), -1);
+		for (i = 0; i < runs.size(); i++) {
+			int l = find(runs[i].label);
+			if (remap[l] < 0) remap[l] = count++;
+			runs[i].label = l;
+		}
+		// the others are complete, or open if they touch the first or last row
+		for (i = 0; i < prevruns.size(); i++) {
+			int l = find(prevruns[i].label);
+			if (remap[l] == -1) {
+				finish(l, first[l] || r == srcBin.rows);
+			}
+		}
+		if (r == srcBin.rows) {
+			band.lastrow = prevruns;
+			for (i = 0; i < band.lastrow.size(); i++) {
+				band.lastrow[i].label = -3 - remap[find(band.lastrow[i].label)];
+			}
+		}
+		// follow the components of the first row until they are open
+		if (r == 0) {
+			band.firstrow = runs;
+		}
+		for (i = 0; i < band.firstrow.size(); i++) {
+			int &l = band.firstrow[i].label;
+			if (l < 0) continue;
+			int m = remap[find(l)];
+			l = (m >= 0) ? m : -1 - (-3 - m);
+		}
+		// keep only the continuing components for the next row
+		nextstats.resize(count);
+		nextfirst.resize(count);
+		for (i = 0; i < runs.size(); i++) {
+			int l = runs[i].label;
+			nextstats[remap[l]] = stats[l];
+			nextfirst[remap[l]] = first[l];
+			runs[i].label = remap[l];
+		}
+		stats.swap(nextstats);
+		first.swap(nextfirst);
+		parent.resize(count);
+		for (int l = 0; l < count; l++) parent[l] = l;
+		prevruns.swap(runs);
+		// the vectors of each swapped pair grow together, otherwise a long row that
+		// lands in the other one of them later needs a larger buffer again
+		runs.reserve(prevruns.capacity());
+		nextstats.reserve(stats.capacity());
+		nextfirst.reserve(first.capacity());
+	}
+	// open labels of the first row were stored negative while following them
+	for (size_t i = 0; i < band.firstrow.size(); i++) {
+		band.firstrow[i].label = -1 - band.firstrow[i].label;
+	}
+}
+
+static int findRoot(std::vector<int> &parent, int label) {
+	while (parent[label] != label) {
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+void cBlobMerger::merge(std::vector<cBlobBand> &bands, std::vector<cBlob> &blobs, int iMode, int minArea) {
+	size_t b, i, j, k;
+
+	blobs.clear();
+	if (iMode == BLOBS_NONE) {
+		return;
+	}
+
+	// all open components in one union-find forest
+	offset.assign(bands.size() + 1, 0);
+	for (b = 0; b < bands.size(); b++) {
+		offset[b + 1] = offset[b] + (int)bands[b].open.size();
+	}
+	parent.resize(offset[bands.size()]);
+	for (i = 0; i < parent.size(); i++) parent[i] = (int)i;
+
+	// join the components touching at the seams, also diagonally
+	for (b = 0; b + 1 < bands.size(); b++) {
+		const std::vector<cBlobRun> &upper = bands[b].lastrow;
+		const std::vector<cBlobRun> &lower = bands[b + 1].firstrow;
+		for (i = 0, j = 0; i < lower.size(); i++) {
+			while (j < upper.size() && upper[j].x1 < lower[i].x0) j++;
+			for (k = j; k < upper.size() && upper[k].x0 <= lower[i].x1; k++) {
+				int l1 = findRoot(parent, offset[b] + upper[k].label);
+				int l2 = findRoot(parent, offset[b + 1] + lower[i].label);
+				if (l1 != l2) parent[l2] = l1;
+			}
+		}
+	}
+
+	// sum up the joined components, in order of the bands
+	merged.assign(parent.size(), cBlobStats());
+	for (b = 0; b < bands.size(); b++) {
+		for (i = 0; i < bands[b].open.size(); i++) {
+			merged[findRoot(parent, offset[b] + (int)i)].merge(bands[b].open[i]);
+		}
+	}
+
+	// complete components of all bands and the joined ones, in scan order
+	all.clear();
+	for (b = 0; b < bands.size(); b++) {
+		all.insert(all.end(), bands[b].complete.begin(), bands[b].complete.end());
+	}
+	for (i = 0; i < merged.size(); i++) {
+		if (parent[i] == (int)i && merged[i].n >= minArea) all.push_back(merged[i]);
+	}
+	std::sort(all.begin(), all.end(),
+		[](const cBlobStats &a, const cBlobStats &b) { return a.isBefore(b); });
+
+	// the first of the largest ones, or all
+	if (iMode == BLOBS_LARGEST) {
+		int best = -1;
+		for (i = 0; i < all.size(); i++) {
+			if (best < 0 || all[i].n > all[best].n) best = (int)i;
+		}
+		if (best >= 0) blobs.push_back(cBlob(all[best]));
+	} else {
+		for (i = 0; i < all.size(); i++) {
+			blobs.push_back(cBlob(all[i]));
+		}
+	}
+}
+
+void mergeBlobBands(std::vector<cBlobBand> &bands, std::vector<cBlob> &blobs, int iMode, int minArea) {
+	cBlobMerger merger;
+	merger.merge(bands, blobs, iMode, minArea);
+}
+
+void FindBlobs(const cv::Mat &srcBin, std::vector<cBlob> &blobs, int iMode, int minArea) {
+	cBlobExtractor extractor;
+	extractor.extract(srcBin, blobs, iMode, minArea);
+}
+
+void DrawBlob(cv::Mat &dstImg, const cBlob &blob) {
+    int dia, centerx, centery;
+    // draw circles around blobs
+    dia = blob.dia;
+    centerx = (int)blob.x;
+    centery = (int)blob.y;
+    cv::circle(dstImg, cv::Point(centerx, centery), dia, cv::Scalar(0, 0, 255), 2);
+    // write out area
+    char c[32];
+    snprintf(c, 32, "A:%d, D:%d", int(blob.area), dia);
+    cv::putText(dstImg, c, cv::Point(centerx + dia + 5, centery), cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
+}
+
+void DrawBlobs(cv::Mat &srcBin, cv::Mat &dstImg, cColor* mColor, int iDrawBlobs) {
+    std::vector<cBlob> blobs;
+
+    // find blobs to draw
+    FindBlobs(srcBin, blobs, iDrawBlobs);
+    for (unsigned int j = 0; j < blobs.size(); j++) {
+        DrawBlob(dstImg, blobs[j]);
+    }
+}
@@ -0,0 +1,127 @@
+// Blob detection on binary filter images.
+
+#ifndef BLOBS_H
+#define BLOBS_H
+
+#include <vector>
+#include <cmath>	// Used to calculate square-root for diameter
+#include <climits>
+#include <stdint.h>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+
+// blob detection modes
+const int BLOBS_NONE = 0;		// do not detect anything
+const int BLOBS_LARGEST = 1;	// only the largest blob
+const int BLOBS_ALL = 2;		// all blobs
+
+// raw pixel moments of a connected component, accumulated run by run
+class cBlobStats {
+public:
+	int64_t n;					// number of pixels
+	int64_t sx, sy;				// sum of x, y
+	int64_t sxx, sxy, syy;		// sum of x*x, x*y, y*y
+	int xmin, xmax, ymin, ymax;	// bounding box, inclusive
+	int xlast;					// left end of the leftmost run in the last row
+	//! Constructor.
+	cBlobStats()
+		:n(0),sx(0),sy(0),sxx(0),sxy(0),syy(0)
+		,xmin(INT_MAX),xmax(INT_MIN),ymin(INT_MAX),ymax(INT_MIN),xlast(INT_MAX)
+	{}
+	// add the pixels x0 <= x < x1 of row y
+	void addRun(int y, int x0, int x1);
+	// add another component
+	void merge(const cBlobStats &other);
+	// is this component finished before the other one in a scan of the image?
+	bool isBefore(const cBlobStats &other) const {
+		return ymax < other.ymax || (ymax == other.ymax && xlast < other.xlast);
+	}
+};
+
+// a detected blob
+class cBlob {
+public:
+	double area;	// area in pixels
+	double x;		// centroid
+	double y;		//		"
+	int dia;		// diameter of the circle with the same area
+	cv::Rect bbox;	// bounding box
+	double mu20;	// second order central moments
+	double mu11;	//		"
+	double mu02;	//		"
+	//! Constructor.
+	cBlob(const cBlobStats &stats);
+};
+
+// a run of foreground pixels in a row
+class cBlobRun {
+public:
+	int x0, x1;		// pixels x0 <= x < x1
+	int label;		// component index
+};
+
+// Blobs found in a band of rows, before they are joined with the neighboring bands.
+class cBlobBand {
+public:
+	std::vector<cBlobStats> complete;	// components inside the band (only the largest one in BLOBS_LARGEST mode)
+	std::vector<cBlobStats> open;		// components touching the first or last row of the band
+	std::vector<cBlobRun> firstrow;		// runs of the first row, labeled with their open component
+	std::vector<cBlobRun> lastrow;		// runs of the last row,		"
+};
+
+// Joins the blobs of adjacent bands of rows, given from top to bottom. The result is
+// the same as extracting the blobs of the whole image at once. Buffers are kept between calls.
+class cBlobMerger {
+public:
+	void merge(std::vector<cBlobBand> &bands, std::vector<cBlob> &blobs, int iMode, int minArea=0);
+private:
+	std::vector<int> offset;			// first open component of each band
+	std::vector<int> parent;			// union-find forest of the open components
+	std::vector<cBlobStats> merged;		// sums of the joined open components
+	std::vector<cBlobStats> all;		// finished components, in scan order
+};
+
+// Connected-component blob extractor (8-connectivity), working on runs of
+// foreground pixels in a single scan of the mask. Components are finished as soon as
+// a row does not continue them, so only two rows of runs are kept at any time.
+// Buffers are kept between calls.
+class cBlobExtractor {
+public:
+	//! Constructor.
+	cBlobExtractor();
+	// find blobs with at least minArea pixels on a binary image
+	void extract(const cv::Mat &srcBin, std::vector<cBlob> &blobs, int iMode, int minArea=0);
+	// find the blobs of a band of rows starting at row y0 of an image; components that
+	// might continue in the bands above or below are left open for mergeBlobBands()
+	void extractBand(const cv::Mat &srcBin, int y0, cBlobBand &band, int iMode, int minArea=0);
+private:
+	int find(int label);
+	int unite(int a, int b);
+	void finish(int label, bool bOpen);
+	std::vector<cBlobRun> prevruns, runs;	// runs of the previous and the current row
+	std::vector<cBlobStats> stats;		// components touching these rows
+	std::vector<cBlobStats> nextstats;	//		"
+	std::vector<uchar> first;			// does the component touch the first row?
+	std::vector<uchar> nextfirst;		//		"
+	std::vector<int> parent;			// union-find forest of components
+	std::vector<int> remap;				// component renumbering between rows
+	cBlobBand *output;
+	std::vector<cBlobBand> bands;		// for extract()
+	cBlobMerger merger;					//		"
+	int mode, minarea;
+};
+
+// join the blobs of adjacent bands of rows with a cBlobMerger of its own
+void mergeBlobBands(std::vector<cBlobBand> &bands, std::vector<cBlob> &blobs, int iMode, int minArea=0);
+
+// find blobs on a binary image
+void FindBlobs(const cv::Mat &srcBin, std::vector<cBlob> &blobs, int iMode, int minArea=0);
+
+void DrawBlob(cv::Mat &dstImg, const cBlob &blob);
+
+void DrawBlobs(cv::Mat &srcBin, cv::Mat &dstImg, cColor* mColor, int iDrawBlobs);
+
+#endif
@@ -0,0 +1,70 @@
+// Thread-safe FIFO queue with limited capacity, used to connect pipeline stages.
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// Items are copied into and out of a ring of slots made up front, so once the slots and
+// the items of the callers have grown to their sizes (e.g. vectors keeping their capacity),
+// nothing is allocated. A slot keeps a copy of its last item until it is reused.
+template <typename T>
+class cBoundedQueue {
+public:
+	//! Constructor.
+	explicit cBoundedQueue(size_t capacity)
+		:items(capacity > 0 ? capacity : 1), head(0), count(0), bClosed(false)
+	{}
+	// add an item, wait while the queue is full; returns false if the queue was closed
+	bool push(const T &item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return bClosed || count < items.size(); });
+		if (bClosed) return false;
+		items[(head + count) % items.size()] = item;
+		count++;
+		notEmpty.notify_one();
+		return true;
+	}
+	// remove the oldest item, wait while the queue is empty; returns false if closed and drained
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return bClosed || count > 0; });
+		if (!count) return false;
+		take(item);
+		notFull.notify_one();
+		return true;
+	}
+	// remove the oldest item if there is one, without waiting
+	bool tryPop(T &item) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!count) return false;
+		take(item);
+		notFull.notify_one();
+		return true;
+	}
+	// no more items will be pushed; consumers still get the queued ones
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		bClosed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+private:
+	// copy out the oldest item, the lock is held
+	void take(T &item) {
+		item = items[head];
+		head = (head + 1) % items.size();
+		count--;
+	}
+	std::vector<T> items;	// ring of capacity slots
+	size_t head;			// slot of the oldest item
+	size_t count;			// number of items
+	bool bClosed;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+};
+
+#endif
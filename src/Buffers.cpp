@@ -0,0 +1,67 @@
+// Reuse of image buffers, and counting of their allocations in debug builds.
+
+#include <algorithm>
+#include <atomic>
+
+#include "Buffers.h"
+
+cv::Mat getScratch(cv::Mat &buffer, int rows, int cols, int type) {
+	if (buffer.type() != type || buffer.rows < rows || buffer.cols < cols) {
+		buffer.create(std::max(rows, buffer.type() == type ? buffer.rows : 0),
+			std::max(cols, buffer.type() == type ? buffer.cols : 0), type);
+	}
+	return buffer(cv::Rect(0, 0, cols, rows));
+}
+
+#ifndef NDEBUG
+
+#if CV_VERSION_MAJOR > 3
+typedef cv::AccessFlag tAccessFlag;
+#else
+typedef int tAccessFlag;
+#endif
+
+// Counts the new buffers and leaves the work to the standard allocator, which also
+// becomes the owner of each buffer and frees it.
+class cCountingAllocator : public cv::MatAllocator {
+public:
+	//! Constructor.
+	cCountingAllocator()
+		:count(0)
+	{}
+	cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+		tAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+	{
+		if (!data) count++; // headers of user memory are not allocations
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+	bool allocate(cv::UMatData *data, tAccessFlag accessflags, cv::UMatUsageFlags usageFlags) const {
+		return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+	}
+	void deallocate(cv::UMatData *data) const {
+		cv::Mat::getStdAllocator()->deallocate(data);
+	}
+	mutable std::atomic<long long> count;
+};
+
+static cCountingAllocator *counter = 0;
+
+void installAllocationCounter() {
+	if (counter) return;
+	counter = new cCountingAllocator(); // never freed, buffers may outlive any scope
+	cv::Mat::setDefaultAllocator(counter);
+}
+
+long long getAllocationCount() {
+	return counter ? (long long)counter->count : -1;
+}
+
+#else
+
+void installAllocationCounter() {}
+
+long long getAllocationCount() {
+	return -1;
+}
+
+#endif
@@ -0,0 +1,21 @@
+// Reuse of image buffers, and counting of their allocations in debug builds.
+
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+// A rows x cols view of a buffer that only grows, so that images of changing sizes
+// (bands, regions) reuse the same memory once the largest one has been seen.
+cv::Mat getScratch(cv::Mat &buffer, int rows, int cols, int type);
+
+// Count the buffers cv::Mat allocates from now on, by installing a counting allocator
+// as its default. Only debug builds count (NDEBUG not defined), otherwise it does nothing.
+// Call it before any other thread is started.
+void installAllocationCounter();
+
+// number of cv::Mat buffers allocated since installAllocationCounter(), or -1 if not counted
+long long getAllocationCount();
+
+#endif
@@ -0,0 +1,120 @@
+// Coarse-to-fine blob detection: a sparse grid of pixels first, full resolution around the hits.
+
+#include <cstring>	// Used for "memcpy"
+#include <algorithm>
+
+#include "CoarseScanner.h"
+#include "HSVConvert.h"
+#include "StageTimer.h"
+
+const int COARSE_TASKS_PER_THREAD = 4; // grid rows are split into this many tasks per thread
+const double COARSE_MAX_WINDOW_FRACTION = 0.5; // scan the whole frame if the windows would cover more
+
+cCoarseScanner::cCoarseScanner(cThreadPool &pool)
+	:pipeline(pool), stride(DEFAULT_COARSE_STRIDE), pool(pool), windowfraction(1), bFullScan(false)
+{
+	pipeline.iBlobMode = BLOBS_ALL;
+	pipeline.bKeepSmoothed = false; // only the blobs are used
+}
+
+// filter the pixels (x, y) of the frame with x and y divisible by the stride
+void cCoarseScanner::scanGrid(const cv::Mat &srcBGR, const cColor &color) {
+	STAGE_TIMER("coarse.grid");
+	int s = stride;
+	int gw = (srcBGR.cols + s - 1) / s;
+	int gh = (srcBGR.rows + s - 1) / s;
+	cHSVLimits limits(color);
+	grid.create(gh, gw, CV_8UC1);
+	int n = std::min(gh, pool.size() * COARSE_TASKS_PER_THREAD);
+	if ((int)rows.size() < 3 * n) rows.resize(3 * n);
+	pool.parallelFor(n, [&](int i) {
+		cv::Mat &blurred = rows[3 * i];
+		cv::Mat &pixels = rows[3 * i + 1];
+		cv::Mat &rowbuffer = rows[3 * i + 2];
+		pixels.create(1, gw, CV_8UC3);
+		uchar *p = pixels.ptr<uchar>(0);
+		for (int gy = gh * i / n; gy < gh * (i + 1) / n; gy++) {
+			cv::Mat row = srcBGR.rowRange(gy * s, gy * s + 1);
+			if (pipeline.bSmooth) {
+				// a row of a frame is blurred with the rows around it, the pixels are the same
+				// as those of the blurred frame
+				smoothFrame(row, blurred, rowbuffer);
+				row = blurred;
+			}
+			const uchar *src = row.ptr<uchar>(0);
+			for (int gx = 0; gx < gw; gx++) {
+				memcpy(p + gx * 3, src + gx * s * 3, 3);
+			}
+			uchar *dst = grid.ptr<uchar>(gy);
+			if (pipeline.lookuptable) {
+				for (int gx = 0; gx < gw; gx++) {
+					dst[gx] = pipeline.lookuptable->contains(p[gx * 3], p[gx * 3 + 1], p[gx * 3 + 2]) ? 255 : 0;
+				}
+			} else {
+				filterBGRRow(dst, p, gw, limits);
+			}
+		}
+	});
+}
+
+void cCoarseScanner::scan(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs) {
+	STAGE_TIMER("coarse");
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	int s = stride;
+	cv::Rect frame(0, 0, srcBGR.cols, srcBGR.rows);
+	bFullScan = s <= 1;
+	if (!bFullScan) {
+		scanGrid(srcBGR, color);
+		{
+			STAGE_TIMER("coarse.candidates");
+			extractor.extract(grid, candidates, BLOBS_ALL);
+		}
+		// a blob with hits reaches at most to the grid pixels around them, except where it
+		// winds between them; processWindows() grows the windows around those
+		windows.clear();
+		double area = 0;	// an upper bound, windows may still overlap
+		for (size_t j = 0; j < candidates.size(); j++) {
+			const cv::Rect &b = candidates[j].bbox;
+			windows.push_back(cv::Rect(b.x * s - s, b.y * s - s, (b.width + 1) * s + 1, (b.height + 1) * s + 1) & frame);
+			area += windows.back().area();
+		}
+		// many windows over most of the frame cost more than a single whole frame scan
+		if (area > COARSE_MAX_WINDOW_FRACTION * frame.area()) {
+			bFullScan = true;
+		} else {
+			STAGE_TIMER("coarse.windows");
+			bFullScan = !pipeline.processWindows(srcBGR, color, windows, s, blobs);
+		}
+	}
+	if (bFullScan) {
+		STAGE_TIMER("coarse.scan");
+		pipeline.process(srcBGR, cv::Mat(), color, smoothed, mask, highlight, blobs);
+		windowfraction = 1;
+		return;
+	}
+	// windows are disjoint after processWindows()
+	double area = 0;
+	for (size_t i = 0; i < windows.size(); i++) {
+		area += windows[i].area();
+	}
+	windowfraction = frame.area() ? area / frame.area() : 0;
+	// by their last row and then from left to right, about the order of a whole frame scan
+	std::sort(blobs.begin(), blobs.end(), [](const cBlob &a, const cBlob &b) {
+		int ya = a.bbox.y + a.bbox.height, yb = b.bbox.y + b.bbox.height;
+		return ya < yb || (ya == yb && a.bbox.x < b.bbox.x);
+	});
+}
+
+int getCoarseSafeDiameter(int stride) {
+	// the inscribed square of a disk of diameter d has sides of d/sqrt(2), and covers
+	// at least floor(d/sqrt(2)) pixels in both directions
+	int d = 1;
+	while (d * d < 2 * stride * stride) d++;
+	return d;
+}
+
+int getCoarseSafeStride(int diameter) {
+	int s = 1;
+	while (2 * (s + 1) * (s + 1) <= diameter * diameter) s++;
+	return s;
+}
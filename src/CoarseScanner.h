@@ -0,0 +1,56 @@
+// Coarse-to-fine blob detection: a sparse grid of pixels first, full resolution around the hits.
+
+#ifndef COARSESCANNER_H
+#define COARSESCANNER_H
+
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "Blobs.h"
+#include "ThreadPool.h"
+#include "TilePipeline.h"
+
+const int DEFAULT_COARSE_STRIDE = 4;	// distance of the tested pixels of the grid
+
+// Finds the blobs of a color without filtering every pixel of the frame. Only every
+// stride-th pixel of every stride-th row is filtered first; the hits are grouped into
+// candidates, and only windows around them are filtered and labeled at full resolution.
+// The blobs found are exactly the same as those of a whole frame scan, except for the
+// ones the grid misses: a blob is always found if it contains a square of stride x stride
+// pixels, e.g. a solid round blob of getCoarseSafeDiameter(stride) pixels diameter.
+class cCoarseScanner {
+public:
+	cTilePipeline pipeline;	// filters the windows; set bSmooth, lookuptable and minArea on it
+	int stride;				// distance of the grid pixels in both directions (1 = every pixel)
+	//! Constructor.
+	explicit cCoarseScanner(cThreadPool &pool);
+	// find the blobs of a color on a frame
+	void scan(const cv::Mat &srcBGR, const cColor &color, std::vector<cBlob> &blobs);
+	// part of the pixels filtered at full resolution on the last frame (the grid not included)
+	double getWindowFraction() const { return windowfraction; }
+	// was the whole frame filtered on the last frame, because the windows would have covered
+	// most of it or kept cutting blobs?
+	bool wasFullScan() const { return bFullScan; }
+private:
+	void scanGrid(const cv::Mat &srcBGR, const cColor &color);
+	cThreadPool &pool;
+	cv::Mat grid;				// filter result of the grid pixels
+	std::vector<cv::Mat> rows;	// blurred grid rows, grid pixels and blur row sums of each task
+	cBlobExtractor extractor;
+	std::vector<cBlob> candidates;	// connected grid hits, in grid coordinates
+	std::vector<cv::Rect> windows;
+	cv::Mat smoothed, mask, highlight;	// outputs of whole frame scans
+	double windowfraction;
+	bool bFullScan;
+};
+
+// smallest diameter of the solid round blobs a grid with the given stride always hits
+int getCoarseSafeDiameter(int stride);
+
+// largest stride of a grid that always hits solid round blobs of the given diameter
+int getCoarseSafeStride(int diameter);
+
+#endif
@@ -10,62 +10,39 @@
 #include <string>	// Used for C++ strings
 #include <iostream>	// Used for C++ cout print statements
 #include <cmath>	// Used to calculate square-root for statistics
+#include <chrono>	// Used to wait for the events to stop before filtering the full frame
 
 // Include OpenCV libraries
 #include <opencv2/opencv.hpp>
 
 #include "VersionNo.h"
+#include "HSVFilter.h"
+#include "Blobs.h"
+#include "BatchMode.h"
+#include "FramePrefetcher.h"
+#include "FrameIndex.h"
+#include "FrameStore.h"
+#include "ColorWheelRenderer.h"
+#include "ThreadPool.h"
+#include "TilePipeline.h"
+#include "BlobTracker.h"
+#include "Detector.h"
+#include "PaletteFilter.h"
+#include "HSVHistogram.h"
+#include "RangeFit.h"
+#include "FrameSampler.h"
+#include "ProgressiveFilter.h"
+#include "StageTimer.h"
+#include "Buffers.h"
+#include "HeapCounter.h"
 
 using namespace std;
 
-const int HUE_RANGE = 180;	// OpenCV just uses Hues between 0 to 179!
-
-const int WIDTH = 361;		// Window size
-const int HEIGHT = 306;		//		"
-const int HUE_HEIGHT = 25;		// thickness of Hue chart
-const int WHEEL_TOP = HUE_HEIGHT + 20;		// y position for top of color wheel (= Hue height + gap)
-const int WHEEL_BOTTOM = WHEEL_TOP + 255;	// y position for bottom of color wheel
-const int TILE_LEFT = 280;	// Position of small tile showing highlighted color
-const int TILE_TOP = 140;	//		"
-const int TILE_W = 60;		//		"
-const int TILE_H = 60;		//		"
-
 const char *windowMain = "HSV Color Wheel. Click a color, or press ESC to quit";	// title of the window
 const char *windowHSVFilter = "Filtered Image. Change HSV Color and Range and check result."; // title of the HSV filter window
 
-// a particle (chip/bin or total ID)
-class cColor {
-public:
-	int H;
-	int S;
-	int V;
-	int rangeH;
-	int rangeS;
-	int rangeV;
-	//! Constructor.
-	cColor()
-		:H(90),S(240),V(200)
-		,rangeH(10),rangeS(50),rangeV(50)
-	{}
-	// overloading 'Equal To' operator
-	bool operator==(const cColor &other) const {
-		if (this->H == other.H &&
-			this->S == other.S &&
-			this->V == other.V &&
-			this->rangeH == other.rangeH &&
-			this->rangeS == other.rangeS &&
-			this->rangeV == other.rangeV)
-			return true;
-		else
-			return false;
-	}
-	// overloading 'Not Equal To' operator
-	bool operator!=(const cColor &other) const {
-		return !(*this == other);
-	}
-};
-
 cColor color;
+cColorWheelRenderer wheelrenderer; // draws the color wheel window
 std::vector<cColor> colorvec; // to draw all saved colors to see how they are organized
 std::vector<cColor> colorhistory; // to be able to have longer undo
 
@@ -80,241 +57,339 @@ int currentframe = 0, currentframe2 = 0; // which frame to read first?
 int framecount = 0; // how many frames are there?
 const double FILTERIMAGEDISPLAYWIDTH = 500; // display width
 cv::Mat inputimage; // original image
+unsigned int inputgeneration = 0; // frame generation counter, incremented whenever inputimage is replaced
+cv::Mat hsvimage; // HSV version of inputimage, cached as long as the frame does not change
+unsigned int hsvgeneration = 0; // frame generation hsvimage was computed from (0 = never)
+cHSVHistogram histogram; // HSV histogram of inputimage, to count selected pixels while dragging
+unsigned int histgeneration = 0; // frame generation the histogram was built from (0 = never)
+bool bFilterDirty = false; // is the filtered image behind the current color?
+// events only mark the windows dirty, they are redrawn once per event loop iteration
+bool bWheelDirty = false; // is the color wheel window behind the current color?
+bool bPreviewDirty = false; // is the HSV filter window behind the current color, even as a preview?
+int pendingframe = 0; // frame the frame trackbar was moved to, counted from 1 (0 = none)
+const int REDRAW_INTERVAL_MS = 15; // longest wait for events before the dirty windows are redrawn
+cIntegralImage integralimage; // integral image of inputimage, for averaging neighborhoods
+unsigned int integralgeneration = 0; // frame generation integralimage was computed from (0 = never)
+int sampleradius = DEFAULT_SAMPLE_RADIUS; // neighbors averaged around a clicked pixel
+cv::Mat filteroutput; // image shown in the HSV filter window
+cv::Point dragstart(-1, -1); // where the middle button was pressed in the HSV filter window
+double filterscale = 1; // pixels of inputimage for one pixel of filteroutput (the preview is smaller)
+std::chrono::steady_clock::time_point lastevent; // when the filter was last changed by an event
+int sampleframes = DEFAULT_SAMPLE_FRAMES; // frames sampled through the video with Ctrl+middle click
 cv::VideoCapture inputvideo; // video
+int prefetchdepth = DEFAULT_PREFETCH_DEPTH; // how many frames to decode ahead?
+cFramePrefetcher prefetcher; // decodes inputvideo in the background
+int nextprefetchframe = 0; // index of the next frame the prefetcher delivers
+cFrameIndex frameindex; // seek points and exact frame count, built in the background
+cFrameCache framecache; // recently shown frames, for scrubbing with the frame trackbar
+bool bExactFrameCount = false; // is framecount coming from the frame index?
+cFrameStore framestore; // frames decoded in an earlier session, replaces inputvideo if open
 bool bInputIsImage = false;
 int iDrawBlobs = 0;
 
 int iHighlightChannel = 3; // 0 = blue, 1 = green, 2 = red, 3 = white
 
-void DrawBlob(cv::Mat &dstImg, cv::Moments& moments) {
-    int dia, centerx, centery;
-    // draw circles around blobs
-    dia = (int)(sqrt(moments.m00 / 3.14159265) * 2);
-    centerx = (int)(moments.m10 / moments.m00);
-    centery = (int)(moments.m01 / moments.m00);
-    cv::circle(dstImg, cv::Point(centerx, centery), dia, cv::Scalar(0, 0, 255), 2);
-    // write out area
-    char c[32];
-    snprintf(c, 32, "A:%d, D:%d", int(moments.m00), dia);
-    cv::putText(dstImg, c, cv::Point(centerx + dia + 5, centery), cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-}
+bool bUseLookupTable = false; // filter BGR directly with the lookup table instead of HSV conversion + inRange
 
-void DrawBlobs(cv::Mat &srcBin, cv::Mat &dstImg, cColor* mColor, int iDrawBlobs) {
-    std::vector<std::vector<cv::Point>> contours;
-    std::vector<cv::Vec4i> hierarchy;
-    cv::Moments moments, largestmoments;
-    unsigned int j = 0;
-    double maxarea = 0;
+bool bShowPalette = false; // show classification with all saved colors instead of the current one
 
-    // do not draw anything on 0
-    if (iDrawBlobs == 0) {
-        return;
-    }
+int numthreads = 0; // how many threads to filter on (0 = one per core)
+cThreadPool threadpool;
+cTilePipeline converter(threadpool); // converts frames to HSV in bands on all threads
+cHSVDetector detector(threadpool); // filters the frames, finds and tracks blobs with the current settings
+cProgressiveFilter refiner(threadpool, detector); // previews while dragging, filters the full frame when idle
 
-    // find blob contours
-    cv::findContours(srcBin, contours, hierarchy, cv::RETR_EXTERNAL,
-        cv::CHAIN_APPROX_NONE, cv::Point(0, 0));
-
-    // Iterate over blobs
-    for (j = 0; j < contours.size(); j++) {
-        // Compute the moments
-        moments = cv::moments(contours[j]);
-        // draw all on 2
-        if (iDrawBlobs == 2) {
-            DrawBlob(dstImg, moments);
-        }
-        else if (iDrawBlobs == 1 && moments.m00 > maxarea) {
-            maxarea = moments.m00;
-            largestmoments = moments;
-        }
-    }
+// working buffers of the display path, kept from call to call so that redrawing
+// frames of the same size does not allocate
+class cDisplayBuffers {
+public:
+	cDetection detection;	// detector results of the frame, its highlight image is shown with blobs
+	cv::Mat previewimage;	// highlighted pyramid level
+	cv::Mat dragimage;		// shown image with the dragged rectangle
+	cv::Mat wheelimage;		// color wheel window
+	std::vector<double> hues, sats, vals;	// histogram marginals of the color
+};
+cDisplayBuffers buffers;
 
-    if (maxarea > 0) {
-        DrawBlob(dstImg, largestmoments);
-    }
-}
+bool bTracking = false; // follow blobs from frame to frame instead of detecting them on each frame
 
+// get HSV version of the input image, converted only once per frame
+cv::Mat &getHSVImage() {
+	if (hsvgeneration != inputgeneration) {
+		STAGE_TIMER("cvtColor");
+		converter.convert(inputimage, hsvimage);
+		hsvgeneration = inputgeneration;
+	}
+	return hsvimage;
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// source: http://www.shervinemami.info/blobs.html
-// input file type must be HSV 8-bit
-// output file type must be same size, binary 8-bit
-void cvFilterHSV(cv::Mat &dstBin, cv::Mat &srcHSV) {
-	int Hmin,Hmax,Smin,Smax,Vmin,Vmax,x;
-
-	// Hue: 0-180, circular continuous
-	Hmin = Hmax = color.H;
-	x = color.rangeH; if (x>89) x = 89;
-	Hmax = (Hmax+x)%180;
-	Hmin = (Hmin+180-x)%180;
-
-	// Saturation: 0-255
-	Smin = Smax = color.S;
-	x = color.rangeS;
-	Smax += x; if (Smax>255) Smax = 255;
-	Smin -= x; if (Smin<0) Smin = 0;
-
-	// Value: 0-255
-	Vmin = Vmax = color.V;
-	x = color.rangeV;
-	Vmax += x; if (Vmax>255) Vmax = 255;
-	Vmin -= x; if (Vmin<0) Vmin = 0;
-
-	// threshold H plane
-	if (Hmax >= Hmin)
-		cv::inRange(srcHSV, cv::Scalar(Hmin,Smin,Vmin), cv::Scalar(Hmax,Smax,Vmax), dstBin);
-	else
-	{
-        cv::Mat tmp;
-		cv::inRange(srcHSV, cv::Scalar(Hmin,Smin,Vmin), cv::Scalar(255,Smax,Vmax), dstBin);
-		cv::inRange(srcHSV, cv::Scalar(0,Smin,Vmin), cv::Scalar(Hmax,Smax,Vmax), tmp);
-		cv::bitwise_or(tmp, dstBin, dstBin);
+// get integral image of the input image, computed only once per frame
+const cIntegralImage &getIntegralImage() {
+	if (integralgeneration != inputgeneration) {
+		integralimage.build(inputimage);
+		integralgeneration = inputgeneration;
 	}
+	return integralimage;
 }
 
-void displayFilteredImage() {
-	// create copy image
-    cv::Mat filterimage, outputimage;
-	// covert to HSV
-	cv::cvtColor(inputimage, outputimage, cv::COLOR_BGR2HSV);
-	// filter it
-    cvFilterHSV(filterimage, outputimage);
-
-    // convert binary to RGB
-    std::vector<cv::Mat> images(3);
-
-    // white
-    if (iHighlightChannel > 2) {
-        images.at(0) = filterimage;
-        images.at(1) = filterimage;
-        images.at(2) = filterimage;
-        cv::merge(images, outputimage);
-        cv::bitwise_or(inputimage, outputimage, outputimage);
-    }
-    // blue, green, red
-    else {
-        cv::split(inputimage, images);
-        cv::bitwise_or(images.at(iHighlightChannel), filterimage, images.at(iHighlightChannel));
-        cv::bitwise_and(images.at((iHighlightChannel + 1) % 3), 255 - filterimage, images.at((iHighlightChannel + 1) % 3));
-        cv::bitwise_and(images.at((iHighlightChannel + 2) % 3), 255 - filterimage, images.at((iHighlightChannel + 2) % 3));
-        cv::merge(images, outputimage);
-    }
+// set up the detector for the current frame with the current settings
+void setupDetector() {
+	static const std::vector<cColor> nopalette;
+	bool bPalette = bShowPalette && colorvec.size();
+	cDetectorOptions options;
+	options.bUseLookupTable = bUseLookupTable;
+	options.iHighlightChannel = iHighlightChannel;
+	options.iBlobMode = iDrawBlobs;
+	options.bTrack = bTracking && !bPalette;
+	detector.setOptions(options);
+	detector.setColor(color);
+	detector.setPalette(bPalette ? colorvec : nopalette);
+}
+
+// classify the image with all saved colors at once and paint each pixel with its palette color
+void displayPaletteImage() {
+	STAGE_TIMER("palette");
+	static std::vector<int> oldcounts;
+	cDetection &detection = buffers.detection;
+
+	// the detector classifies with the saved colors, paints them and finds the blobs
+	setupDetector();
+	detector.detect(currentframe, inputimage, getHSVImage(), detection);
 
 	// draw blobs on it
-    DrawBlobs(filterimage, outputimage, &color, iDrawBlobs);
+	for (unsigned int j = 0; j < detection.blobs.size(); j++) {
+		DrawBlob(detection.highlight, detection.blobs[j]);
+	}
+	// show it
+	cv::imshow(windowHSVFilter, detection.highlight);
+	filteroutput = detection.highlight;
+	filterscale = 1;
+
+	// write pixel counts to output
+	const std::vector<int> &counts = detection.counts;
+	if (counts != oldcounts) {
+		cout << "palette pixel counts:";
+		for (int k = 1; k < (int)counts.size(); k++) {
+			cout << " " << k << ":" << counts[k];
+		}
+		cout << " none:" << counts[0] << endl;
+		oldcounts = counts;
+	}
+}
+
+// draw the blobs or tracks of a detection on its highlight image and show it
+void showFilteredImage(cDetection &detection) {
+	cv::Mat &outputimage = detection.highlight;
+	// draw blobs on it
+	{
+		STAGE_TIMER("drawblobs");
+		if (bTracking) {
+			const std::vector<cTrack> &tracks = detection.tracks;
+			for (unsigned int j = 0; j < tracks.size(); j++) {
+				if (!tracks[j].missed) DrawTrack(outputimage, tracks[j]);
+			}
+		} else {
+			for (unsigned int j = 0; j < detection.blobs.size(); j++) {
+				DrawBlob(outputimage, detection.blobs[j]);
+			}
+		}
+	}
     // show it
+	STAGE_TIMER("imshow.filter");
 	cv::imshow(windowHSVFilter, outputimage);
+	filteroutput = outputimage;
+	filterscale = 1;
+}
+
+void displayFilteredImage() {
+	STAGE_TIMER("event.filter");
+	refiner.cancel();
+	bPreviewDirty = false;
+	bFilterDirty = false;
+	// palette mode
+	if (bShowPalette && colorvec.size()) {
+		displayPaletteImage();
+		return;
+	}
+	// filter it, either straight from BGR with the lookup table or from the cached HSV image,
+	// highlight the result and find or follow blobs, in bands on all threads
+	setupDetector();
+	cv::Mat hsv = bUseLookupTable ? cv::Mat() : getHSVImage();
+	detector.detect(currentframe, inputimage, hsv, buffers.detection);
+	showFilteredImage(buffers.detection);
+}
+
+// show the filter result at the size of the window right away, the full frame is filtered when idle
+void displayPreviewImage() {
+	STAGE_TIMER("event.preview");
+	refiner.cancel();
+	bPreviewDirty = false;
+	bFilterDirty = true;
+	lastevent = std::chrono::steady_clock::now();
+	// the palette is only shown when idle
+	if (bShowPalette && colorvec.size()) return;
+	// the HSV frame of the prefetcher or the store, if it is there
+	cv::Mat hsv = hsvgeneration == inputgeneration ? hsvimage : cv::Mat();
+	filterscale = refiner.preview(inputimage, hsv, inputgeneration, color, (int)FILTERIMAGEDISPLAYWIDTH,
+		iHighlightChannel, buffers.previewimage);
+	STAGE_TIMER("imshow.preview");
+	cv::imshow(windowHSVFilter, buffers.previewimage);
+	filteroutput = buffers.previewimage;
+}
+
+// draw the color wheel with the number of pixels the color selects on the current frame
+void drawColorWheel() {
+	cv::Mat &imageRGB = buffers.wheelimage;
+
+	// Draw the color wheel from its prerendered parts
+	{
+		STAGE_TIMER("wheel.render");
+		wheelrenderer.render(imageRGB, color, colorvec);
+	}
+
+	// count selected pixels from the histogram of the frame instead of filtering it
+	{
+		STAGE_TIMER("wheel.histogram");
+		if (histgeneration != inputgeneration) {
+			histogram.build(getHSVImage(), threadpool);
+			histgeneration = inputgeneration;
+		}
+		histogram.getMarginals(color, buffers.hues, buffers.sats, buffers.vals);
+		wheelrenderer.renderMarginals(imageRGB, buffers.hues, buffers.sats, buffers.vals);
+		wheelrenderer.renderCoverage(imageRGB, histogram.count(color), histogram.getTotal());
+	}
+
+	// Display the RGB image
+	{
+		STAGE_TIMER("imshow.wheel");
+		cv::imshow(windowMain, imageRGB);
+	}
+}
+
+// show the frame with the given index (counted from 0), from the cache or by seeking
+bool seekToFrame(int frame) {
+	STAGE_TIMER("seek");
+	refiner.cancel(); // it reads the frame that is replaced
+	if (framestore.isOpen()) {
+		// frames are mapped from the store, nothing is decoded or copied
+		if (!framestore.get(frame, inputimage, &hsvimage)) {
+			cout << "error reading frame " << frame + 1 << " from the frame store!" << endl;
+			return false;
+		}
+		currentframe = frame + 1;
+		inputgeneration++; // invalidate per-frame caches
+		if (framestore.hasHSV()) hsvgeneration = inputgeneration;
+		return true;
+	}
+	if (!framecache.get(frame, inputimage)) {
+		// decode forward from the video position or from the nearest seek point
+		cFrameSeeker seeker(inputvideo, inputfile, &frameindex, &framecache);
+		seeker.position = prefetcher.stop(&framecache);
+		bool bOk = seeker.read(frame, inputimage);
+		// continue decoding ahead from where the seek stopped
+		prefetcher.start(inputvideo, prefetchdepth, seeker.position);
+		nextprefetchframe = seeker.position;
+		if (!bOk) {
+			cout << "error seeking to frame " << frame + 1 << "!" << endl;
+			return false;
+		}
+	}
+	currentframe = frame + 1;
+	inputgeneration++; // invalidate per-frame caches
+	return true;
 }
 
 int getNewFramesFromVideo(int n=1) {
-	cv::Mat tempimage;
-	int i = 0;
-	while (i<n) {
-		if (framecount && currentframe && currentframe >= framecount) break;
-        inputvideo.read(tempimage);
-		if (tempimage.empty())
+	STAGE_TIMER("event.frame");
+	refiner.cancel(); // it reads the frame that is replaced
+	int oldframe = currentframe;
+	if (framecount && currentframe && currentframe + n > framecount) n = framecount - currentframe;
+	if (n <= 0) return 0;
+	int target = currentframe + n - 1; // index of the new frame
+	if (framestore.isOpen()) {
+		// any frame of the store is at hand
+		seekToFrame(target);
+	} else if (nextprefetchframe <= target) {
+		// frames are decoded and smoothed in the background, this only swaps buffers
+		int i;
 		{
-			cout << "error reading new frame from video!" << endl;
-			return i;
+			STAGE_TIMER("frame.wait");
+			i = prefetcher.next(inputimage, hsvimage, target - nextprefetchframe + 1);
+		}
+		nextprefetchframe += i;
+		if (i) {
+			currentframe = nextprefetchframe;
+			inputgeneration++; // invalidate per-frame caches
+			hsvgeneration = inputgeneration; // the prefetcher converted it already
+			framecache.put(currentframe - 1, inputimage);
 		}
-		inputimage = tempimage;
-		currentframe++;
-		i++;
+	} else {
+		// we went back with the trackbar, the prefetcher is already ahead
+		seekToFrame(target);
 	}
-    // gaussian smoothing of input image to reduce speckle/interlace noise
-    if (i) {
-        cv::GaussianBlur(inputimage, inputimage, cv::Size(3, 3), 0);
-    }
-	return i;
+	if (currentframe - oldframe < n) {
+		cout << "error reading new frame from video!" << endl;
+	}
+	return currentframe - oldframe;
 }
 
 //void getImageFromVideo(int state, void* userdata) // used by cvCreateButtom
 void getImageFromVideo(int pos, void *userdata) { // used by cvCreateTrackbar
-//	if (currentframe >= framecount) return;
-	// TODO bug: the line below had to be commented out because in our rat stream it does not work. Always reading the next frame...
-	//cvSetCaptureProperty(inputvideo,CV_CAP_PROP_POS_FRAMES,currentframe);
-//	getNewFramesFromVideo();
+	// the frame is read once the events of this loop iteration are over, scrubbing skips the frames in between
+	pendingframe = pos < 1 ? 1 : pos;
+}
+
+// show the frame the frame trackbar was moved to, counted from 1
+void showPendingFrame() {
+	int pos = pendingframe;
+	pendingframe = 0;
+	if (pos != currentframe) {
+		seekToFrame(pos - 1);
+	}
 	displayFilteredImage();
+	bWheelDirty = true; // selected pixels of the new frame
 	currentframe2 = currentframe;
 }
 
-void displayColorWheelHSV(void) {
-	static cColor oldcolor;
-	cv::Mat imageHSV(cv::Size(WIDTH, HEIGHT), CV_8UC3);
-	int rowSize = (int)imageHSV.step;	// Size of row in bytes, including extra padding
-	unsigned char *imOfs = imageHSV.data;	// Pointer to the start of the image HSV pixels.
-
-	// Clear the image to grey (Saturation=0)
-	imageHSV.setTo(cv::Scalar(0,0,210, 0));
-
-	// Draw the hue chart on the top, at double width.
-	for (int y=0; y<HUE_HEIGHT; y++) {
-		for (int x=0; x<HUE_RANGE; x++) {
-			uchar h = x;		// Hue (0 - 179)
-			uchar s = 255;		// max Saturation => most colorful
-			uchar v = 255;		// max Value => brightest color
-			// Highlight the current value
-			if ((h == color.H-2 || h == color.H+2) && (y < HUE_HEIGHT/2)) {
-				s = 0;	// make it white instead of the color
-			}
-			// Set the HSV pixel components
-			*(uchar*)(imOfs + y*rowSize + (x*2+0)*3 + 0) = h;
-			*(uchar*)(imOfs + y*rowSize + (x*2+0)*3 + 1) = s;
-			*(uchar*)(imOfs + y*rowSize + (x*2+0)*3 + 2) = v;
-			*(uchar*)(imOfs + y*rowSize + (x*2+1)*3 + 0) = h;
-			*(uchar*)(imOfs + y*rowSize + (x*2+1)*3 + 1) = s;
-			*(uchar*)(imOfs + y*rowSize + (x*2+1)*3 + 2) = v;
-		}
+// called when no event arrived for a while
+void idle() {
+	// show the full frame once it is filtered in the background
+	if (refiner.finish(buffers.detection)) {
+		bFilterDirty = false;
+		showFilteredImage(buffers.detection);
 	}
-
-	// Draw the color wheel: Saturation on the x-axis and Value (brightness) on the y-axis.
-	for (int y=0; y<255; y++) {
-		for (int x=0; x<255; x++) {
-			uchar h = color.H;		// Hue (0 - 179)
-			uchar s = x;		// Saturation (0 - 255)
-			uchar v = (255-y);	// Value (Brightness) (0 - 255)
-			// Highlight the current value
-			if ((s == color.S-2 || s == color.S-3 || s == color.S+2 || s == color.S+3) && (v == color.V-2 || v == color.V-3 || v == color.V+2 || v == color.V+3)) {
-				s = 0;	// make it white instead of the color
-				v = 0;	// bright white
-			}
-			// Set the HSV pixel components
-			*(uchar*)(imOfs + (y+WHEEL_TOP)*rowSize + x*3 + 0) = h;
-			*(uchar*)(imOfs + (y+WHEEL_TOP)*rowSize + x*3 + 1) = s;
-			*(uchar*)(imOfs + (y+WHEEL_TOP)*rowSize + x*3 + 2) = v;
+	// catch up with the color changes of the last events, when they stopped for a while
+	if (bFilterDirty && !refiner.isRunning() && std::chrono::steady_clock::now() - lastevent >=
+		std::chrono::milliseconds(REFINE_DELAY_MS))
+	{
+		if (bShowPalette && colorvec.size()) {
+			displayFilteredImage();
+		} else {
+			setupDetector();
+			// HSV is converted band by band if it is not cached, so that it can be canceled too
+			bool bHSV = !bUseLookupTable && hsvgeneration == inputgeneration;
+			refiner.start(currentframe, inputimage, bHSV ? hsvimage : cv::Mat());
 		}
 	}
-
-	// highlight the saved colors
-	for (std::vector<cColor>::iterator it = colorvec.begin(); it<colorvec.end(); ++it) {
-		// H
-		cv::rectangle(imageHSV,
-			cv::Point((*it).H*2-(*it).rangeH,1),
-			cv::Point((*it).H*2+(*it).rangeH,HUE_HEIGHT-1),
-			cv::Scalar(0,0,0),1);
-		// S + V
-		cv::rectangle(imageHSV,
-			cv::Point((*it).S-(*it).rangeS/2,WHEEL_TOP+255-(*it).V-(*it).rangeV/2),
-			cv::Point((*it).S+(*it).rangeS/2,WHEEL_TOP+255-(*it).V+(*it).rangeV/2),
-			cv::Scalar((*it).H,255,255),1);
-	}
-
-	// Draw a small tile of the highlighted color.
-	for (int y=0; y<TILE_H; y++) {
-		for (int x=0; x<TILE_W; x++) {
-			// Set the HSV pixel components
-			*(uchar*)(imOfs + (y+TILE_TOP)*rowSize + (x+TILE_LEFT)*3 + 0) = color.H;
-			*(uchar*)(imOfs + (y+TILE_TOP)*rowSize + (x+TILE_LEFT)*3 + 1) = color.S;
-			*(uchar*)(imOfs + (y+TILE_TOP)*rowSize + (x+TILE_LEFT)*3 + 2) = color.V;
-		}
+	// replace the unreliable frame count of the stream with the exact one
+	if (!bInputIsImage && !bExactFrameCount && frameindex.isReady()) {
+		bExactFrameCount = true;
+		framecount = frameindex.getFrameCount();
+		// TODO bug: max trackbar range in Win32 is 32767
+		if (framecount>32768) framecount = 32768;
+		cout << " exact framecount: " << framecount << endl;
+#if (CV_VERSION_MAJOR > 3) || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+		cv::setTrackbarMax("frame", windowMain, framecount);
+#endif
 	}
+}
 
-	// Convert the HSV image to RGB (BGR) for displaying
-	cv::Mat imageRGB(cv::Size(imageHSV.cols, imageHSV.rows), CV_8UC3);
-	cv::cvtColor(imageHSV, imageRGB, cv::COLOR_HSV2BGR);	// (note that OpenCV stores RGB images in B,G,R order.
+void displayColorWheelHSV(void) {
+	STAGE_TIMER("event.wheel");
+	static cColor oldcolor;
 
-	// Display the RGB image
-	cv::imshow(windowMain, imageRGB);
+	bWheelDirty = false;
+	drawColorWheel();
 
 	// write text to output
 	if (oldcolor != color) {
@@ -322,13 +397,37 @@ void displayColorWheelHSV(void) {
 				<< " rangeHSV: " << color.rangeH << " " << color.rangeS << " " << color.rangeV << endl;
 		oldcolor = color;
 	}
-	// update HSV filter window
-	displayFilteredImage();
 }
 
 // This function is automatically called whenever the user changes the trackbar value.
+// Setting all trackbars at once calls it for each of them, so it only marks the windows.
 void color_trackbarWasChanged(int pos, void *userdata) {
-	displayColorWheelHSV();
+	bWheelDirty = true;
+	bPreviewDirty = true;
+}
+
+// set all color trackbars to the current color
+void updateTrackbars() {
+	cv::setTrackbarPos("Hue", windowMain, color.H);
+	cv::setTrackbarPos("Saturation", windowMain, color.S);
+	cv::setTrackbarPos("Brightness", windowMain, color.V);
+	cv::setTrackbarPos("rangeH", windowMain, color.rangeH);
+	cv::setTrackbarPos("rangeS", windowMain, color.rangeS);
+	cv::setTrackbarPos("rangeV", windowMain, color.rangeV);
+}
+
+// redraw the windows the events of this loop iteration marked dirty, each only once
+void redraw() {
+	if (pendingframe) {
+		showPendingFrame();
+	}
+	if (bWheelDirty) {
+		displayColorWheelHSV();
+	}
+	// the HSV filter window is previewed now and filtered at full resolution when the events stop
+	if (bPreviewDirty) {
+		displayPreviewImage();
+	}
 }
 
 void undo(bool bUpdateGUI=true) {
@@ -350,12 +449,7 @@ void undo(bool bUpdateGUI=true) {
 
     if (bUpdateGUI) {
         // update the GUI Trackbars
-        cv::setTrackbarPos("Hue", windowMain, color.H);
-        cv::setTrackbarPos("Saturation", windowMain, color.S);
-        cv::setTrackbarPos("Brightness", windowMain, color.V);
-        cv::setTrackbarPos("rangeH", windowMain, color.rangeH);
-        cv::setTrackbarPos("rangeS", windowMain, color.rangeS);
-        cv::setTrackbarPos("rangeV", windowMain, color.rangeV);
+        updateTrackbars();
     }
 }
 
@@ -373,8 +467,7 @@ static void mouseEvent( int ievent, int x, int y, int flags, void* param ) {
 			if (mouseX/2 < HUE_RANGE) {	// Make sure its a valid Hue
 				color.H = mouseX/2;
 				cv::setTrackbarPos("Hue", windowMain, color.H);	// update the GUI Trackbar
-				// Note that "cv::setTrackbarPos()" will implicitly call "displayColorWheelHSV()" for a changed hue.
-				//displayColorWheelHSV();
+				// Note that "cv::setTrackbarPos()" will implicitly mark the windows for redrawing for a changed hue.
 			}
 		}
 		// If they clicked on the Color wheel, select the new value.
@@ -384,52 +477,139 @@ static void mouseEvent( int ievent, int x, int y, int flags, void* param ) {
 				color.V = 255 - (mouseY - WHEEL_TOP);
 				cv::setTrackbarPos("Saturation", windowMain, color.S);	// update the GUI Trackbar
 				cv::setTrackbarPos("Brightness", windowMain, color.V);	// update the GUI Trackbar
-				// Note that "cv::setTrackbarPos()" will implicitly call "displayColorWheelHSV()" for saturation or brightness.
-				//displayColorWheelHSV();
+				// Note that "cv::setTrackbarPos()" will implicitly mark the windows for redrawing for saturation or brightness.
 			}
 		}
 	}
 }
 
+// set the color and range to fit a region of the input image
+void fitRegion(const cv::Rect &region, const cv::Mat &mask) {
+	colorhistory.push_back(color); // save old color
+	int n = FitColorRange(color, getHSVImage()(region), mask, DEFAULT_FIT_PERCENTILE);
+	if (!n) {
+		colorhistory.pop_back();
+		return;
+	}
+	avgpixnum = n;
+	avgcolornum = 0;
+	cout << "range fitted to " << n << " pixels" << endl;
+	// update the GUI Trackbars
+	updateTrackbars();
+}
+
+// set the color and range to cover a region on frames spread through the whole video
+void sampleAcrossVideo(int x, int y) {
+	if (bInputIsImage) {
+		cout << "sampling across frames needs a video" << endl;
+		return;
+	}
+	// the clicked tracked blob, or the neighborhood of the pixel
+	cv::Rect region(x - sampleradius, y - sampleradius, 2 * sampleradius + 1, 2 * sampleradius + 1);
+	if (bTracking) {
+		const std::vector<cTrack> &tracks = buffers.detection.tracks;
+		for (unsigned int j = 0; j < tracks.size(); j++) {
+			if (tracks[j].missed || !tracks[j].blob.bbox.contains(cv::Point(x, y))) continue;
+			int half = (int)(tracks[j].blob.dia * 0.35); // square inside the blob
+			region = cv::Rect((int)tracks[j].blob.x - half, (int)tracks[j].blob.y - half, 2 * half + 1, 2 * half + 1);
+			cout << "sampling blob #" << tracks[j].id << endl;
+			break;
+		}
+	}
+	cout << "sampling " << region.width << "x" << region.height << " pixels at " << region.x << "," << region.y
+		<< " on " << sampleframes << " frames..." << endl;
+	std::vector<cFrameSample> samples;
+	cColor merged;
+	int n = SampleAcrossVideo(inputfile, &frameindex, framestore.isOpen() ? &framestore : 0, framecount,
+		sampleframes, region, threadpool, samples, merged);
+	if (!n) {
+		cout << "error reading frames for sampling!" << endl;
+		return;
+	}
+	// report the range of each frame and how much of it the merged range misses
+	cout << " frame   meanH     H   S   V  rangeH  S   V  clipped" << endl;
+	for (unsigned int j = 0; j < samples.size(); j++) {
+		const cFrameSample &f = samples[j];
+		if (!f.bRead) {
+			printf("%6d  not read\n", f.frame + 1);
+			continue;
+		}
+		printf("%6d  %6.1f   %3d %3d %3d   %3d %3d %3d   %5.1f%%\n", f.frame + 1, f.meanH,
+			f.color.H, f.color.S, f.color.V, f.color.rangeH, f.color.rangeS, f.color.rangeV, f.clipped * 100);
+	}
+	fflush(stdout);
+	cout << "range fitted to " << n << " frames" << endl;
+	colorhistory.push_back(color); // save old color
+	color = merged;
+	avgpixnum = 1;
+	avgcolornum = 0;
+	// update the GUI Trackbars
+	updateTrackbars();
+}
+
 // This function is automatically called whenever the user clicks the mouse in the HSV filter window.
 void mouseEvent2( int ievent, int x, int y, int flags, void* param ) {
+	// the window may show a preview smaller than the frame
+	x = cvRound(x * filterscale);
+	y = cvRound(y * filterscale);
+	if (ievent != cv::EVENT_MOUSEMOVE) {
+		refiner.cancel(); // buttons change the color or read the frame on all threads
+	}
+	// middle button: drag a rectangle, or click to select the region of similar color
+	// around a pixel, and fit the color range to it
+	if (ievent == cv::EVENT_MBUTTONDOWN) {
+		// Ctrl+middle button: fit to the same place on many frames of the video
+		if (flags & cv::EVENT_FLAG_CTRLKEY) {
+			sampleAcrossVideo(x, y);
+		} else {
+			dragstart = cv::Point(x, y);
+		}
+		return;
+	}
+	if (dragstart.x >= 0) {
+		cv::Rect frame(0, 0, inputimage.cols, inputimage.rows);
+		cv::Rect region = cv::Rect(std::min(dragstart.x, x), std::min(dragstart.y, y),
+			abs(x - dragstart.x) + 1, abs(y - dragstart.y) + 1) & frame;
+		if (ievent == cv::EVENT_MOUSEMOVE && !filteroutput.empty()) {
+			cv::Mat &preview = buffers.dragimage;
+			filteroutput.copyTo(preview);
+			cv::Rect shown(cvRound(region.x / filterscale), cvRound(region.y / filterscale),
+				cvRound(region.width / filterscale), cvRound(region.height / filterscale));
+			cv::rectangle(preview, shown, cv::Scalar(0, 255, 255), 2);
+			cv::imshow(windowHSVFilter, preview);
+		} else if (ievent == cv::EVENT_MBUTTONUP) {
+			dragstart = cv::Point(-1, -1);
+			bFilterDirty = true; // remove the rectangle
+			if (region.width > 2 || region.height > 2) {
+				fitRegion(region, cv::Mat());
+			} else if (frame.contains(cv::Point(x, y))) {
+				cv::Mat mask;
+				region = FloodFillRegion(inputimage, cv::Point(x, y), DEFAULT_FLOOD_TOLERANCE, mask);
+				fitRegion(region, mask);
+			}
+		}
+		return;
+	}
 	// left mouse click
 	if (flags & cv::EVENT_FLAG_LBUTTON) {
 		// Ctrl+left button click: save color, Ctrl+Shift+left: clear all colors
 		if (flags & cv::EVENT_FLAG_CTRLKEY)
 		{
 			if (flags & cv::EVENT_FLAG_SHIFTKEY) colorvec.clear(); // clear all saved colors
+			else if ((int)colorvec.size() >= MAX_PALETTE_SIZE) {
+				cout << "palette is full (" << MAX_PALETTE_SIZE << " colors), color not saved" << endl;
+				return;
+			}
 			else colorvec.push_back(color); // save current color
 			// update the color windows
-			displayColorWheelHSV();
+			bWheelDirty = true;
+			bPreviewDirty = true;
 		}
 		// Shift+left button click: average colors
 		else if (flags & cv::EVENT_FLAG_SHIFTKEY) {
             colorhistory.push_back(color); // save old color
-			cv::Vec3d pixel;
-			int i,j;
-			// average (2*n+1)^2 pixel neighborhood
-			int n = 2; // neighbour radius (1-->3, 2-->5 etc.)
-			if (!x) { x++; } if (x == inputimage.cols) { x--; }
-			if (!y) { y++; } if (y == inputimage.rows) { y--; }
-			for (i=0;i<3;i++) pixel.val[i] = 0;
-			for (i=-n;i<=n;i++)
-			{
-				for (j=-n;j<=n;j++)
-				{
-					pixel.val[0] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[0];
-					pixel.val[1] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[1];
-					pixel.val[2] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[2];
-				}
-			}
-			n = (2*n+1)*(2*n+1);
-			for (i=0;i<3;i++) pixel.val[i] /= n;
-			// get pixel color in HSV format
-			//Cv::Scalar pixel = cvGet2D(inputimage,x,y); // bugbugbug this does not work somehow... BUT why???
-			cv::Mat tmp(cv::Size(1,1), CV_8UC3);
-            tmp.at<cv::Vec3b>(0, 0) = pixel;
-			cv::cvtColor(tmp, tmp, cv::COLOR_BGR2HSV);
-            pixel = tmp.at<cv::Vec3b>(0, 0);
+			// get the HSV color of the average of the neighborhood
+			cv::Vec3d pixel = getIntegralImage().getMeanHSV(x, y, sampleradius);
 			// set new average color
 			color.H = (color.H * avgcolornum + (int)pixel.val[0]) / (avgcolornum + 1);
 			color.S = (color.S * avgcolornum + (int)pixel.val[1]) / (avgcolornum + 1);
@@ -448,27 +628,8 @@ void mouseEvent2( int ievent, int x, int y, int flags, void* param ) {
             colorhistory.push_back(color); // save old color
 			avgpixnum = 1; // reset counter to current selection
 			avgcolornum = 0; // reset counter
-			cv::Vec3d pixel;
-			int i,j;
-			// average (2*n+1)^2 pixel neighborhood
-			int n = 2; // neighbour radius (1-->3, 2-->5 etc.)
-			if (!x) { x++; } if (x == inputimage.cols) { x--; }
-			if (!y) { y++; } if (y == inputimage.rows) { y--; }
-			for (i=0;i<3;i++) pixel.val[i] = 0;
-			for (i=-n;i<=n;i++) {
-				for (j=-n;j<=n;j++) {
-					pixel.val[0] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[0];
-					pixel.val[1] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[1];
-					pixel.val[2] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[2];
-				}
-			}
-			n = (2*n+1)*(2*n+1);
-			for (i=0;i<3;i++) pixel.val[i] /= n;
-			// get pixel color in HSV format
-			cv::Mat tmp(cv::Size(1,1), CV_8UC3);
-            tmp.at<cv::Vec3b>(0, 0) = pixel;
-			cv::cvtColor(tmp, tmp, cv::COLOR_BGR2HSV);
-            pixel = tmp.at<cv::Vec3b>(0, 0);
+			// get the HSV color of the average of the neighborhood
+			cv::Vec3d pixel = getIntegralImage().getMeanHSV(x, y, sampleradius);
 			// store new value
 			color.H = (int)pixel.val[0];
 			color.S = (int)pixel.val[1];
@@ -488,28 +649,9 @@ void mouseEvent2( int ievent, int x, int y, int flags, void* param ) {
 		// right button: adjust range exactly to fit all that are pointed
 		else {
             colorhistory.push_back(color); // save old color
-			cv::Vec3d pixel;
+			// get the HSV color of the average of the neighborhood
+			cv::Vec3d pixel = getIntegralImage().getMeanHSV(x, y, sampleradius);
 			int i,j;
-			// average (2*n+1)^2 pixel neighborhood
-			int n = 2; // neighbour radius (1-->3, 2-->5 etc.)
-			if (!x) { x++; } if (x == inputimage.cols) { x--; }
-			if (!y) { y++; } if (y == inputimage.rows) { y--; }
-			for (i=0;i<3;i++) pixel.val[i] = 0;
-			for (i=-n;i<=n;i++) {
-				for (j=-n;j<=n;j++) {
-					pixel.val[0] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[0];
-					pixel.val[1] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[1];
-					pixel.val[2] += inputimage.at<cv::Vec3b>(cv::Point(x + i, y + j))[2];
-				}
-			}
-			n = (2*n+1)*(2*n+1);
-			for (i=0;i<3;i++) pixel.val[i] /= n;
-			// get pixel color in HSV format
-			//CvScalar pixel = cvGet2D(inputimage,x,y); // bugbugbug this does not work somehow... BUT why???
-			cv::Mat tmp(cv::Size(1,1),CV_8UC3);
-            tmp.at<cv::Vec3b>(0, 0) = pixel;
-			cv::cvtColor(tmp,tmp,cv::COLOR_BGR2HSV);
-            pixel = tmp.at<cv::Vec3b>(0, 0);
 			// if Ctrl+Shift+right button is pressed, reset tight inclusion
             if ((flags & cv::EVENT_FLAG_CTRLKEY) && (flags & cv::EVENT_FLAG_SHIFTKEY)) {
                 avgpixnum = 0;
@@ -580,34 +722,52 @@ void mouseEvent2( int ievent, int x, int y, int flags, void* param ) {
 		} // right button pressed (no Ctrl)
 
 		// update the GUI Trackbars
-		cv::setTrackbarPos("Hue", windowMain, color.H);
-        cv::setTrackbarPos("Saturation", windowMain, color.S);
-        cv::setTrackbarPos("Brightness", windowMain, color.V);
-        cv::setTrackbarPos("rangeH", windowMain, color.rangeH);
-        cv::setTrackbarPos("rangeS", windowMain, color.rangeS);
-        cv::setTrackbarPos("rangeV", windowMain, color.rangeV);
+		updateTrackbars();
 	} // right button pressed
 }
 
+// show that building a frame store still goes on
+void printStoreProgress(int frames) {
+	cout << "  " << frames << " frames stored" << endl;
+}
+
 // C++ entry point
 int main(int argc, char **argv)
 {
+	// debug builds count image buffer allocations, to check that redrawing does not allocate
+	installAllocationCounter();
+
+	// headless batch mode, stdout is reserved for the output records
+	if (argc > 1 && !strcmp(argv[1], "--batch")) {
+		return runBatchMode(argc, argv);
+	}
+
 	cout << "HSV Color Wheel, by Shervin Emami (shervin.emami@gmail.com), 6th Nov 2009." << endl;
 	cout << "HSVFiltering part added by Gabor Vasarhelyi (vasarhelyi@hal.elte.hu), since Jan 2011." << endl;
 	cout << "Current version: " << VERSION_FILESTR << endl;
 	cout << endl;
+	cout << "Run with --batch for headless processing of a video without windows." << endl;
+	cout << "Use --prefetch <depth> before the input file to set how many frames are decoded ahead (default " << DEFAULT_PREFETCH_DEPTH << ")." << endl;
+	cout << "Use --cache <MB> before the input file to set the memory used for recently shown frames (default " << DEFAULT_FRAMECACHE_MB << ")." << endl;
+	cout << "Use --threads <n> before the input file to set how many threads filter the image (default: one per core)." << endl;
+	cout << "Use --store <file> before the input file to decode the video once into a frame store, later sessions read it instead of the video." << endl;
+	cout << "Use --timers before the input file to measure the latency of each processing stage, --timers-json <file> to also save them." << endl;
+	cout << endl;
 	cout << "Click on the top Hue map, or the bottom Color graph to change values." << endl;
 	cout << endl;
 	cout << "Mouse clicks on the image might help you as well:" << endl;
-	cout << "  LEFT button: change values to 3x3 neighbor average color. Do not change range." << endl;
+	cout << "  LEFT button: change values to 5x5 neighbor average color (radius set with a). Do not change range." << endl;
 	cout << "  Shift+LEFT button: Average colors. Do not change range." << endl;
-    cout << "  Ctrl+LEFT button: save current color and range and draw it on the palette." << endl;
+    cout << "  Ctrl+LEFT button: save current color and range and draw it on the palette (up to 255 colors)." << endl;
     cout << "  Ctrl+Shift+LEFT button: clear all saved colors+ranges." << endl;
     cout << endl;
     cout << "  RIGHT button: include this pixel to new range as tight as possible." << endl;
     cout << "  Shift+RIGHT button: undo last mouseclick or console color input" << endl;
     cout << "  Ctrl+RIGHT button: undo last mouseclick or console color input" << endl;
     cout << "  Ctrl+Shift+RIGHT button: reset inclusion of multiple colors" << endl;
+    cout << "  MIDDLE button drag: fit color and range to the pixels of a rectangle" << endl;
+    cout << "  MIDDLE button click: fit color and range to the region of similar color around the pixel" << endl;
+    cout << "  Ctrl+MIDDLE button: fit color and range to the neighborhood (or tracked blob) on frames spread through the video" << endl;
     cout << endl;
 	cout << "Keyboard shortcuts (working only when the image window is the active one):" << endl;
 	cout << "  n/N     - next frame" << endl;
@@ -616,23 +776,81 @@ int main(int argc, char **argv)
 	cout << "  H, S, V - start writing a number in the console, on Enter it will update color.rangeH, .rangeS, .rangeV, respectively" << endl;
 	cout << "  c/C     - start writing three numbers in the console with space between, on Enter it will update all color.H, .S, .V" << endl;
 	cout << "  r/R     - start writing three numbers in the console with space between, on Enter it will update all color.rangeH, .rangeS, .rangeV" << endl;
+	cout << "  m/M     - start writing a number in the console, on Enter it will set the number of frames sampled with Ctrl+MIDDLE" << endl;
+	cout << "  a/A     - start writing a number in the console, on Enter it will set the radius of the neighborhood averaged on mouse clicks" << endl;
     cout << "  d/D     - draw red circles and show area/diameter around none/largest/all blobs" << endl;
     cout << "  x/X     - change highlight color (blue, green, red, white)" << endl;
+    cout << "  l/L     - switch between HSV conversion and BGR lookup table filtering" << endl;
+    cout << "  p/P     - show classification with all saved colors (palette) or with the current color only" << endl;
+    cout << "  k/K     - track blobs from frame to frame (only searched around their predicted positions)" << endl;
+    cout << "  t/T     - print the latency of each processing stage so far (starts measuring if it was off)" << endl;
     cout << "  BackSpace - undo last color or range selection (of mouse clicks or console input)" << endl;
 	cout << endl;
 
-	if (argc > 2) {
-		cout << "Please pvovide max 1 arg as input file name!" << endl;
-		return -1;
-	} else if (argc == 2) {
-		strncpy(inputfile, argv[1], sizeof(inputfile));
-	} else if (argc < 2) {
+	// parse command line: [--prefetch <depth>] [--cache <MB>] [--threads <n>] [--store <file>] [--timers] [--timers-json <file>] [inputfile]
+	const char *timersfile = 0;
+	const char *storefile = 0;
+	inputfile[0] = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--prefetch") && i + 1 < argc) {
+			prefetchdepth = atoi(argv[++i]);
+			if (prefetchdepth < 1) prefetchdepth = 1;
+		} else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+			framecache.setMaxBytes((size_t)atoi(argv[++i]) << 20);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			numthreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--store") && i + 1 < argc) {
+			storefile = argv[++i];
+		} else if (!strcmp(argv[i], "--timers")) {
+			enableStageTimers(true);
+		} else if (!strcmp(argv[i], "--timers-json") && i + 1 < argc) {
+			enableStageTimers(true);
+			timersfile = argv[++i];
+		} else if (!inputfile[0]) {
+			strncpy(inputfile, argv[i], sizeof(inputfile) - 1);
+		} else {
+			cout << "Please pvovide max 1 arg as input file name!" << endl;
+			return -1;
+		}
+	}
+	threadpool.start(numthreads);
+	// a frame store made earlier replaces the video, it is opened without decoding anything
+	bool bStored = storefile && framestore.open(storefile);
+	if (!bStored && !inputfile[0]) {
 		cout << "Enter input file: ";
 		cin >> inputfile;
 	}
-	cout << endl << "opening file " << inputfile << endl;
+	if (bStored && inputfile[0] && !framestore.isMadeFrom(inputfile)) {
+		cout << endl << "frame store " << storefile << " was made from " << framestore.getSource()
+			<< " (or an earlier version of it), not from " << inputfile << endl;
+		framestore.close();
+		bStored = false;
+	}
+	if (storefile && !bStored) {
+		if (!cFrameStore::canReplace(storefile, inputfile)) {
+			cout << "error: " << storefile << " is the input file or not a frame store, it is not overwritten!" << endl;
+			return -1;
+		}
+		cout << endl << "decoding " << inputfile << " into frame store " << storefile << " (only once)" << endl;
+		int n = cFrameStore::build(inputfile, storefile, true, printStoreProgress);
+		if (n < 1 || !framestore.open(storefile)) {
+			cout << "error creating frame store!" << endl;
+			return -1;
+		}
+		cout << n << " frames stored" << endl;
+	}
+	if (framestore.isOpen()) {
+		cout << endl << "reading frames from store " << storefile << " (made from " << framestore.getSource() << ")" << endl;
+	} else {
+		cout << endl << "opening file " << inputfile << endl;
+	}
 	// init input image
-	if (!inputvideo.open(inputfile)) {
+	if (framestore.isOpen()) {
+		bInputIsImage = false;
+		// the frame count of a store is exact
+		framecount = framestore.getFrameCount();
+		bExactFrameCount = true;
+	} else if (!inputvideo.open(inputfile)) {
 		cout << "error opening input video file, trying as image..." << endl;
 		inputimage = cv::imread(inputfile);
 		if (inputimage.empty()) {
@@ -640,13 +858,21 @@ int main(int argc, char **argv)
 			return -1;
 		} else {
 			bInputIsImage = true;
+			inputgeneration++; // invalidate per-frame caches
 		}
 	} else {
 		bInputIsImage = false;
+		// from now on inputvideo is only used through the prefetcher
+		prefetcher.start(inputvideo, prefetchdepth);
+		// find seek points and count frames in the background
+		frameindex.build(inputfile);
 	}
 	// get first 5 frames until something really appears from the stream
 	currentframe = 0;
-	if (!bInputIsImage) {
+	if (framestore.isOpen()) {
+		// stored frames are known to be good, start with the first one
+		if (!seekToFrame(0)) return -1;
+	} else if (!bInputIsImage) {
 		int i = getNewFramesFromVideo(5);
 		if (i == 0) {
 			return -1;
@@ -667,8 +893,10 @@ int main(int argc, char **argv)
 
 	// TODO bug: sometimes first readout returns 0 in Win32. Why?
 	// TODO bug: rat stream is buggy, framecount can be invalid
-	if (!bInputIsImage) {
-		framecount = (int)inputvideo.get(cv::CAP_PROP_FRAME_COUNT);
+	if (framestore.isOpen()) {
+		framecount = framestore.getFrameCount();
+	} else if (!bInputIsImage) {
+		framecount = (int)prefetcher.get(cv::CAP_PROP_FRAME_COUNT);
 	} else {
 		framecount = 1;
 	}
@@ -677,7 +905,7 @@ int main(int argc, char **argv)
 	cout << " framecount: " << framecount << endl;
 	//inputvideo.set(CV_CAP_PROP_POS_FRAMES,currentframe);
 	if (!bInputIsImage) {
-		cv::createTrackbar( "frame", windowMain, &currentframe2, framecount-1, &getImageFromVideo );
+		cv::createTrackbar( "frame", windowMain, &currentframe2, framecount, &getImageFromVideo );
 	}
 	// TODO bug: unreferenced external symbol cvCreateButton
 	// solution: http://stackoverflow.com/questions/4458668/opencv-2-2-createbutton-lnk-2019-error-in-visual-studio-2010
@@ -696,6 +924,7 @@ int main(int argc, char **argv)
 
 	// initialize display
 	displayColorWheelHSV();
+	displayFilteredImage();
 
 	// wait infinitely until Esc or Ctrl-C is pressed
 	int a,b,c;
@@ -703,10 +932,20 @@ int main(int argc, char **argv)
     int lasti = 0;
     int lastcommand = 0;
     int countdigits = 0;
+    long long lastallocations = 0;
+    long long lastheap = 0;
     char digits[40];
 	while (i != 27 && i != 3 && i != -1) {
+        int key = cv::waitKey(REDRAW_INTERVAL_MS);
+        // draw what the events changed
+        redraw();
+        // no event for a while
+        if (key == -1) {
+            idle();
+            continue;
+        }
         lasti = i;
-        i = (cv::waitKey(0) & 255);
+        i = (key & 255);
         if (!lastcommand) {
             if (!bInputIsImage) {
                 // f, F
@@ -739,6 +978,18 @@ int main(int argc, char **argv)
                 countdigits = 0;
                 lastcommand = 'r';
             }
+            // m, M
+            else if (i == 'm' || i == 'M') {
+                cout << "Please enter the number of frames sampled with Ctrl+MIDDLE click (now " << sampleframes << "):" << endl;
+                countdigits = 0;
+                lastcommand = 'm';
+            }
+            // a, A
+            else if (i == 'a' || i == 'A') {
+                cout << "Please enter the radius of the neighborhood averaged on mouse clicks (now " << sampleradius << "):" << endl;
+                countdigits = 0;
+                lastcommand = 'a';
+            }
         }
         // digits and space (within lastcommand)
         else if (i == ' ' || (i >= '0' && i <= '9')) {
@@ -816,6 +1067,14 @@ int main(int argc, char **argv)
                         cout << "invalid value, try again" << endl;
                     }
                 }
+                else if (lastcommand == 'a') {
+                    sampleradius = max(0, atoi(digits));
+                    cout << "averaging " << 2 * sampleradius + 1 << "x" << 2 * sampleradius + 1 << " pixels on mouse clicks" << endl;
+                }
+                else if (lastcommand == 'm') {
+                    sampleframes = max(1, atoi(digits));
+                    cout << "sampling " << sampleframes << " frames on Ctrl+MIDDLE click" << endl;
+                }
                 else if (lastcommand == 'r') {
                     if (sscanf(digits, "%d %d %d", &a, &b, &c) == 3) {
                         colorhistory.push_back(color);
@@ -844,6 +1103,43 @@ int main(int argc, char **argv)
             iHighlightChannel = (iHighlightChannel + 1) % 4;
             displayFilteredImage();
         }
+        // switch filter engine
+        else if (i == 'l' || i == 'L') {
+            bUseLookupTable = !bUseLookupTable;
+            cout << "filtering with " << (bUseLookupTable ? "BGR lookup table" : "HSV conversion") << endl;
+            displayFilteredImage();
+        }
+        // switch palette view
+        else if (i == 'p' || i == 'P') {
+            bShowPalette = !bShowPalette;
+            cout << (bShowPalette ? "showing all saved colors" : "showing current color") << endl;
+            displayFilteredImage();
+        }
+        // switch blob tracking
+        else if (i == 'k' || i == 'K') {
+            bTracking = !bTracking;
+            detector.reset();
+            cout << (bTracking ? "tracking blobs" : "tracking off") << endl;
+            displayFilteredImage();
+        }
+        // stage latencies
+        else if (i == 't' || i == 'T') {
+            if (isStageTimerEnabled()) {
+                printStageTimers(cout);
+                // debug builds: buffers allocated since the last report, 0 while redrawing the same frame
+                if (getAllocationCount() >= 0) {
+                    cout << getAllocationCount() - lastallocations << " image buffers allocated since the last report" << endl;
+                    lastallocations = getAllocationCount();
+                }
+                if (getHeapAllocationCount() >= 0) {
+                    cout << getHeapAllocationCount() - lastheap << " heap blocks allocated since the last report" << endl;
+                    lastheap = getHeapAllocationCount();
+                }
+            } else {
+                enableStageTimers(true);
+                cout << "measuring stage latencies, press t again to see them" << endl;
+            }
+        }
 
         // anything else
         else if (!lastcommand) {
@@ -854,6 +1150,18 @@ int main(int argc, char **argv)
 	}
 
 	cv::destroyAllWindows();
+	refiner.cancel();
+	prefetcher.stop();
+	frameindex.stop();
+	threadpool.stop();
+
+	// stage latencies of the whole session
+	if (isStageTimerEnabled()) {
+		printStageTimers(cout);
+		if (timersfile && !writeStageTimersJSON(timersfile)) {
+			cout << "error writing " << timersfile << endl;
+		}
+	}
 
 	return 0;
 }
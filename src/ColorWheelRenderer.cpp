@@ -0,0 +1,173 @@
+// Rendering of the HSV color wheel window.
+
+#include <cstdio>	// Used for "snprintf"
+#include <cmath>
+#include <algorithm>
+
+#include "ColorWheelRenderer.h"
+
+cv::Scalar HSV2BGR(int h, int s, int v) {
+	// one pixel on the stack, it is converted on each redraw
+	cv::Vec3b hsv(cv::saturate_cast<uchar>(h), cv::saturate_cast<uchar>(s), cv::saturate_cast<uchar>(v)), bgr;
+	cv::Mat src(1, 1, CV_8UC3, hsv.val), dst(1, 1, CV_8UC3, bgr.val);
+	cv::cvtColor(src, dst, cv::COLOR_HSV2BGR);
+	return cv::Scalar(bgr[0], bgr[1], bgr[2]);
+}
+
+cColorWheelRenderer::cColorWheelRenderer()
+	:planes(256)
+{}
+
+void cColorWheelRenderer::renderBackground() {
+	cv::Mat imageHSV(cv::Size(WIDTH, HEIGHT), CV_8UC3);
+
+	// Clear the image to grey (Saturation=0)
+	imageHSV.setTo(cv::Scalar(0,0,210, 0));
+
+	// Draw the hue chart on the top, at double width.
+	for (int y=0; y<HUE_HEIGHT; y++) {
+		uchar *p = imageHSV.ptr<uchar>(y);
+		for (int x=0; x<HUE_RANGE; x++) {
+			uchar h = x;		// Hue (0 - 179)
+			uchar s = 255;		// max Saturation => most colorful
+			uchar v = 255;		// max Value => brightest color
+			// Set the HSV pixel components
+			p[(x*2+0)*3 + 0] = h;
+			p[(x*2+0)*3 + 1] = s;
+			p[(x*2+0)*3 + 2] = v;
+			p[(x*2+1)*3 + 0] = h;
+			p[(x*2+1)*3 + 1] = s;
+			p[(x*2+1)*3 + 2] = v;
+		}
+	}
+
+	cv::cvtColor(imageHSV, background, cv::COLOR_HSV2BGR);
+}
+
+const cv::Mat &cColorWheelRenderer::getPlane(uchar h) {
+	cv::Mat &plane = planes[h];
+	if (plane.empty()) {
+		// Saturation on the x-axis and Value (brightness) on the y-axis.
+		cv::Mat imageHSV(255, 255, CV_8UC3);
+		for (int y=0; y<255; y++) {
+			uchar *p = imageHSV.ptr<uchar>(y);
+			for (int x=0; x<255; x++) {
+				p[x*3 + 0] = h;			// Hue (0 - 179)
+				p[x*3 + 1] = x;			// Saturation (0 - 255)
+				p[x*3 + 2] = 255-y;		// Value (Brightness) (0 - 255)
+			}
+		}
+		cv::cvtColor(imageHSV, plane, cv::COLOR_HSV2BGR);
+	}
+	return plane;
+}
+
+void cColorWheelRenderer::render(cv::Mat &dstBGR, const cColor &color, const std::vector<cColor> &colorvec) {
+	int i, j;
+	if (background.empty()) renderBackground();
+	background.copyTo(dstBGR);
+
+	// Highlight the current hue with white on the upper half of the hue chart
+	cv::Vec3b white(255, 255, 255);
+	int hues[2] = { color.H-2, color.H+2 };
+	for (i=0; i<2; i++) {
+		if (hues[i] < 0 || hues[i] >= HUE_RANGE) continue;
+		for (int y=0; y<HUE_HEIGHT/2; y++) {
+			dstBGR.at<cv::Vec3b>(y, hues[i]*2+0) = white;
+			dstBGR.at<cv::Vec3b>(y, hues[i]*2+1) = white;
+		}
+	}
+
+	// Draw the color wheel of the current hue
+	cv::Mat wheel = dstBGR(cv::Rect(0, WHEEL_TOP, 255, 255));
+	getPlane((uchar)color.H).copyTo(wheel);
+
+	// Highlight the current saturation and value with black dots
+	cv::Vec3b black(0, 0, 0);
+	int sats[4] = { color.S-3, color.S-2, color.S+2, color.S+3 };
+	int vals[4] = { color.V-3, color.V-2, color.V+2, color.V+3 };
+	for (i=0; i<4; i++) {
+		if (sats[i] < 0 || sats[i] >= 255) continue;
+		for (j=0; j<4; j++) {
+			int y = 255 - vals[j];
+			if (y < 0 || y >= 255) continue;
+			dstBGR.at<cv::Vec3b>(y+WHEEL_TOP, sats[i]) = black;
+		}
+	}
+
+	// highlight the saved colors
+	for (std::vector<cColor>::const_iterator it = colorvec.begin(); it<colorvec.end(); ++it) {
+		// H
+		cv::rectangle(dstBGR,
+			cv::Point((*it).H*2-(*it).rangeH,1),
+			cv::Point((*it).H*2+(*it).rangeH,HUE_HEIGHT-1),
+			HSV2BGR(0,0,0),1);
+		// S + V
+		cv::rectangle(dstBGR,
+			cv::Point((*it).S-(*it).rangeS/2,WHEEL_TOP+255-(*it).V-(*it).rangeV/2),
+			cv::Point((*it).S+(*it).rangeS/2,WHEEL_TOP+255-(*it).V+(*it).rangeV/2),
+			HSV2BGR((*it).H,255,255),1);
+	}
+
+	// Draw a small tile of the highlighted color.
+	dstBGR(cv::Rect(TILE_LEFT, TILE_TOP, TILE_W, TILE_H)).setTo(HSV2BGR((uchar)color.H, (uchar)color.S, (uchar)color.V));
+}
+
+// bar lengths of a histogram scaled to at most size pixels
+static void getBarLengths(const std::vector<double> &counts, int size, std::vector<int> &lengths) {
+	double maxcount = 0;
+	for (size_t i = 0; i < counts.size(); i++) maxcount = std::max(maxcount, counts[i]);
+	lengths.assign(counts.size(), 0);
+	if (maxcount <= 0) return;
+	for (size_t i = 0; i < counts.size(); i++) {
+		lengths[i] = (int)ceil(sqrt(std::max(counts[i], 0.0) / maxcount) * size);
+	}
+}
+
+void cColorWheelRenderer::renderMarginals(cv::Mat &dstBGR, const std::vector<double> &hues,
+	const std::vector<double> &sats, const std::vector<double> &vals)
+{
+	std::vector<int> lengths;
+	cv::Vec3b dark(90, 90, 90);
+
+	// hues: darken the lower half of the hue chart from the bottom
+	getBarLengths(hues, HUE_HEIGHT - HUE_HEIGHT/2, lengths);
+	for (int h = 0; h < (int)lengths.size() && h < HUE_RANGE; h++) {
+		for (int y = HUE_HEIGHT - lengths[h]; y < HUE_HEIGHT; y++) {
+			uchar *p = dstBGR.ptr<uchar>(y) + h*2*3;
+			for (int k = 0; k < 6; k++) p[k] /= 3;
+		}
+	}
+	// saturations: bars above the wheel, aligned with its x axis
+	if (!sats.empty()) {
+		int w = 256 / (int)sats.size();
+		getBarLengths(sats, MARGINAL_SIZE, lengths);
+		for (int b = 0; b < (int)lengths.size(); b++) {
+			for (int y = WHEEL_TOP - 1 - lengths[b]; y < WHEEL_TOP - 1; y++) {
+				for (int x = b*w; x < (b+1)*w && x < 255; x++) dstBGR.at<cv::Vec3b>(y, x) = dark;
+			}
+		}
+	}
+	// values: bars right of the wheel, aligned with its y axis (brightest on top)
+	if (!vals.empty()) {
+		int w = 256 / (int)vals.size();
+		getBarLengths(vals, MARGINAL_SIZE, lengths);
+		for (int b = 0; b < (int)lengths.size(); b++) {
+			for (int v = b*w; v < (b+1)*w; v++) {
+				int y = WHEEL_TOP + 255 - v;
+				if (y > WHEEL_BOTTOM - 1) continue;
+				for (int x = 256; x < 256 + lengths[b]; x++) dstBGR.at<cv::Vec3b>(y, x) = dark;
+			}
+		}
+	}
+}
+
+void cColorWheelRenderer::renderCoverage(cv::Mat &dstBGR, double selected, int total) {
+	char c[32];
+	cv::Scalar black(0, 0, 0);
+	cv::putText(dstBGR, "selected:", cv::Point(TILE_LEFT, COVERAGE_TOP), cv::FONT_HERSHEY_SIMPLEX, 0.4, black, 1);
+	snprintf(c, sizeof(c), "%.2f%%", total ? selected * 100 / total : 0.0);
+	cv::putText(dstBGR, c, cv::Point(TILE_LEFT, COVERAGE_TOP + 16), cv::FONT_HERSHEY_SIMPLEX, 0.4, black, 1);
+	snprintf(c, sizeof(c), "~%.0f px", selected);
+	cv::putText(dstBGR, c, cv::Point(TILE_LEFT, COVERAGE_TOP + 32), cv::FONT_HERSHEY_SIMPLEX, 0.4, black, 1);
+}
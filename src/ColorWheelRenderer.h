@@ -0,0 +1,53 @@
+// Rendering of the HSV color wheel window.
+
+#ifndef COLORWHEELRENDERER_H
+#define COLORWHEELRENDERER_H
+
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+
+const int HUE_RANGE = 180;	// OpenCV just uses Hues between 0 to 179!
+
+const int WIDTH = 361;		// Window size
+const int HEIGHT = 306;		//		"
+const int HUE_HEIGHT = 25;		// thickness of Hue chart
+const int WHEEL_TOP = HUE_HEIGHT + 20;		// y position for top of color wheel (= Hue height + gap)
+const int WHEEL_BOTTOM = WHEEL_TOP + 255;	// y position for bottom of color wheel
+const int TILE_LEFT = 280;	// Position of small tile showing highlighted color
+const int TILE_TOP = 140;	//		"
+const int TILE_W = 60;		//		"
+const int TILE_H = 60;		//		"
+const int MARGINAL_SIZE = 18;	// height of the histogram bars next to the hue chart and the wheel
+const int COVERAGE_TOP = TILE_TOP + TILE_H + 20;	// position of the selected pixel count
+
+// Renders the color wheel from prerendered BGR parts: the background with the hue chart
+// is rendered on first use, and the Saturation/Value plane of each hue is rendered on first use
+// and kept. An update only copies these and draws the markers, saved colors and the tile.
+class cColorWheelRenderer {
+public:
+	//! Constructor.
+	cColorWheelRenderer();
+	// render the wheel of the current color and the saved colors into a BGR image
+	void render(cv::Mat &dstBGR, const cColor &color, const std::vector<cColor> &colorvec);
+	// Overlay histograms of the image: pixels of each hue on the lower half of the hue chart,
+	// of each saturation above the wheel and of each value right of it. Counts are drawn on
+	// a square root scale, relative to the largest one.
+	void renderMarginals(cv::Mat &dstBGR, const std::vector<double> &hues,
+		const std::vector<double> &sats, const std::vector<double> &vals);
+	// write the number and ratio of pixels selected by the current color
+	void renderCoverage(cv::Mat &dstBGR, double selected, int total);
+private:
+	void renderBackground();
+	const cv::Mat &getPlane(uchar h);
+	cv::Mat background;				// grey background and the hue chart
+	std::vector<cv::Mat> planes;	// Saturation/Value plane of each hue, empty until used
+};
+
+// BGR color of an HSV color
+cv::Scalar HSV2BGR(int h, int s, int v);
+
+#endif
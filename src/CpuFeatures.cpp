@@ -0,0 +1,51 @@
+// Runtime detection of the SIMD instruction sets usable by the image kernels.
+
+#include "CpuFeatures.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static int simdlimit = SIMD_AVX2;
+
+static int detectSIMDLevel() {
+#if !defined(HAVE_X86_SIMD)
+	return SIMD_NONE;
+#elif defined(_MSC_VER)
+	int info[4];
+	int level = SIMD_NONE;
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26)) level = SIMD_SSE2;
+	if (level == SIMD_SSE2 && (info[2] & (1 << 9))) level = SIMD_SSSE3;
+	// AVX2 also needs the OS to save the ymm registers (OSXSAVE + XCR0)
+	bool bOSSavesYMM = (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+	__cpuidex(info, 7, 0);
+	if (level == SIMD_SSSE3 && bOSSavesYMM && (info[1] & (1 << 5))) level = SIMD_AVX2;
+	return level;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+	if (__builtin_cpu_supports("ssse3")) return SIMD_SSSE3;
+	if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+	return SIMD_NONE;
+#endif
+}
+
+int getSIMDLevel() {
+	static const int detected = detectSIMDLevel();
+	return detected < simdlimit ? detected : simdlimit;
+}
+
+void limitSIMDLevel(int level) {
+	simdlimit = level;
+}
+
+const char *getSIMDLevelName(int level) {
+	switch (level) {
+		case SIMD_SSE2: return "SSE2";
+		case SIMD_SSSE3: return "SSSE3";
+		case SIMD_AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
@@ -0,0 +1,34 @@
+// Runtime detection of the SIMD instruction sets usable by the image kernels.
+
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_X86_SIMD
+#endif
+
+// compile single functions for instruction sets that are only used after runtime checks
+#if defined(__GNUC__) && !defined(_MSC_VER)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+// SIMD levels, each includes the previous ones
+const int SIMD_NONE = 0;
+const int SIMD_SSE2 = 1;
+const int SIMD_SSSE3 = 2;
+const int SIMD_AVX2 = 3;
+
+// best SIMD level supported by the CPU and the OS, limited by limitSIMDLevel()
+int getSIMDLevel();
+
+// do not use SIMD levels above the given one (e.g. to compare kernels)
+void limitSIMDLevel(int level);
+
+// name of a SIMD level
+const char *getSIMDLevelName(int level);
+
+#endif
@@ -0,0 +1,206 @@
+// Detection of colored blobs in the frames of a stream, without any global state.
+
+#include "Detector.h"
+#include "StageTimer.h"
+
+void cDetection::swap(cDetection &other) {
+	std::swap(frame, other.frame);
+	std::swap(windowfraction, other.windowfraction);
+	cv::swap(mask, other.mask);
+	cv::swap(highlight, other.highlight);
+	cv::swap(labels, other.labels);
+	counts.swap(other.counts);
+	blobs.swap(other.blobs);
+	ids.swap(other.ids);
+	tracks.swap(other.tracks);
+}
+
+cHSVDetector::cHSVDetector(cThreadPool &pool)
+	:pipeline(pool), tracker(pool), coarse(pool), trackframe(-1)
+{
+	pipeline.bKeepSmoothed = false;
+}
+
+void cHSVDetector::setColor(const cColor &color) {
+	std::lock_guard<std::mutex> lock(settingsmutex);
+	this->color = color;
+}
+
+cColor cHSVDetector::getColor() const {
+	std::lock_guard<std::mutex> lock(settingsmutex);
+	return color;
+}
+
+void cHSVDetector::setPalette(const std::vector<cColor> &palette) {
+	std::lock_guard<std::mutex> lock(settingsmutex);
+	// the vector keeps its buffer, setting the palette of each frame does not allocate
+	this->palette.assign(palette.begin(), palette.end());
+}
+
+void cHSVDetector::setOptions(const cDetectorOptions &options) {
+	std::lock_guard<std::mutex> lock(settingsmutex);
+	this->options = options;
+}
+
+cDetectorOptions cHSVDetector::getOptions() const {
+	std::lock_guard<std::mutex> lock(settingsmutex);
+	return options;
+}
+
+void cHSVDetector::reset() {
+	std::lock_guard<std::mutex> lock(detectmutex);
+	tracker.reset();
+	trackframe = -1;
+}
+
+bool cHSVDetector::detect(int frame, const cv::Mat &srcBGR, const cv::Mat &srcHSV, cDetection &result,
+	const std::atomic<bool> *cancel)
+{
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	std::lock_guard<std::mutex> lock(detectmutex);
+	// the settings of this frame, they may be changed while it is detected
+	cColor color;
+	cDetectorOptions options;
+	{
+		std::lock_guard<std::mutex> settings(settingsmutex);
+		color = this->color;
+		options = this->options;
+		currentpalette.assign(palette.begin(), palette.end());
+	}
+	result.frame = frame;
+	result.windowfraction = 1;
+	result.ids.clear();
+	result.tracks.clear();
+	if (!currentpalette.empty()) {
+		detectPalette(srcBGR, srcHSV, options, result);
+		return true;
+	}
+	result.counts.clear();
+
+	if (options.bUseLookupTable) {
+		STAGE_TIMER("lookuptable.update");
+		lookuptable.update(color);
+	}
+	pipeline.bSmooth = options.bSmooth;
+	pipeline.lookuptable = options.bUseLookupTable ? &lookuptable : 0;
+	pipeline.iHighlightChannel = options.iHighlightChannel;
+	// highlighting needs every pixel, then the blobs come from the whole frame too
+	bool bCoarse = options.coarseStride > 1 && !options.bTrack && options.iHighlightChannel < 0;
+	pipeline.iBlobMode = (options.bTrack || bCoarse) ? BLOBS_NONE : options.iBlobMode;
+	pipeline.minArea = options.minArea;
+	// when tracking, the whole frame is only filtered for the highlight image
+	if (!(options.bTrack || bCoarse) || options.iHighlightChannel >= 0) {
+		STAGE_TIMER("pipeline");
+		pipeline.cancel = cancel;
+		bool bComplete = pipeline.process(srcBGR, srcHSV, color, smoothedunused, result.mask, result.highlight, result.blobs);
+		pipeline.cancel = 0;
+		if (!bComplete) return false;
+	}
+	if (options.bTrack) {
+		detectTracks(frame, srcBGR, color, options, result);
+	} else if (bCoarse) {
+		detectCoarse(srcBGR, color, options, result);
+	}
+	return true;
+}
+
+void cHSVDetector::detectTracks(int frame, const cv::Mat &srcBGR, const cColor &color,
+	const cDetectorOptions &options, cDetection &result)
+{
+	// follow blobs to a new frame, or find them again with a new color
+	if (frame != trackframe || color != trackcolor) {
+		if (frame != trackframe + 1 || color != trackcolor) {
+			tracker.reset(); // the frame was not the next one, positions cannot be predicted
+		}
+		tracker.pipeline.bSmooth = options.bSmooth;
+		tracker.pipeline.lookuptable = pipeline.lookuptable;
+		tracker.pipeline.minArea = options.minArea;
+		tracker.rescanInterval = options.rescanInterval;
+		tracker.track(srcBGR, color);
+		trackframe = frame;
+		trackcolor = color;
+	}
+	// keep the tracked blobs seen on the frame
+	const std::vector<cTrack> &tracks = tracker.getTracks();
+	result.tracks.assign(tracks.begin(), tracks.end());
+	result.blobs.clear();
+	if (options.iBlobMode == BLOBS_NONE) return;
+	for (unsigned int j = 0; j < tracks.size(); j++) {
+		if (tracks[j].missed) continue;
+		if (options.iBlobMode == BLOBS_LARGEST && result.blobs.size()) {
+			if (tracks[j].blob.area <= result.blobs[0].area) continue;
+			result.blobs.clear();
+			result.ids.clear();
+		}
+		result.blobs.push_back(tracks[j].blob);
+		result.ids.push_back(tracks[j].id);
+	}
+}
+
+void cHSVDetector::detectCoarse(const cv::Mat &srcBGR, const cColor &color, const cDetectorOptions &options,
+	cDetection &result)
+{
+	coarse.stride = options.coarseStride;
+	coarse.pipeline.bSmooth = options.bSmooth;
+	coarse.pipeline.lookuptable = pipeline.lookuptable;
+	coarse.pipeline.minArea = options.minArea;
+	coarse.scan(srcBGR, color, result.blobs);
+	result.windowfraction = coarse.getWindowFraction();
+	if (options.iBlobMode == BLOBS_NONE) {
+		result.blobs.clear();
+	} else if (options.iBlobMode == BLOBS_LARGEST && result.blobs.size()) {
+		size_t largest = 0;
+		for (size_t j = 1; j < result.blobs.size(); j++) {
+			if (result.blobs[j].area > result.blobs[largest].area) largest = j;
+		}
+		std::swap(result.blobs[0], result.blobs[largest]);
+		result.blobs.erase(result.blobs.begin() + 1, result.blobs.end());
+	}
+}
+
+void cHSVDetector::detectPalette(const cv::Mat &srcBGR, const cv::Mat &srcHSV, const cDetectorOptions &options,
+	cDetection &result)
+{
+	cv::Mat bgr = srcBGR;
+	if (options.bSmooth) {
+		smoothFrame(srcBGR, smoothed, rowbuffer);
+		bgr = smoothed;
+	}
+	// the palette is classified in HSV
+	cv::Mat hsvframe = srcHSV;
+	if (hsvframe.empty()) {
+		pipeline.convert(bgr, hsv);
+		hsvframe = hsv;
+	}
+	palettefilter.update(currentpalette);
+	palettefilter.filter(result.labels, hsvframe, result.counts);
+
+	// BGR color for each label
+	cv::Vec3b *colors = 0;
+	if (options.iHighlightChannel >= 0) {
+		labelcolorsHSV.create(1, MAX_PALETTE_SIZE + 1, CV_8UC3);
+		labelcolorsHSV.setTo(cv::Scalar(0,0,0));
+		for (int k = 0; k < palettefilter.size(); k++) {
+			labelcolorsHSV.at<cv::Vec3b>(0, k + 1) = cv::Vec3b(currentpalette[k].H, 255, 255);
+		}
+		cv::cvtColor(labelcolorsHSV, labelcolors, cv::COLOR_HSV2BGR);
+		colors = labelcolors.ptr<cv::Vec3b>(0);
+		bgr.copyTo(result.highlight);
+	}
+
+	// paint labeled pixels, collect them for blob detection
+	const cv::Mat &labels = result.labels;
+	result.mask.create(labels.size(), CV_8UC1);
+	for (int y = 0; y < labels.rows; y++) {
+		const uchar *l = labels.ptr<uchar>(y);
+		uchar *f = result.mask.ptr<uchar>(y);
+		cv::Vec3b *o = colors ? result.highlight.ptr<cv::Vec3b>(y) : 0;
+		for (int x = 0; x < labels.cols; x++) {
+			f[x] = l[x] ? 255 : 0;
+			if (l[x] && o) {
+				o[x] = colors[l[x]];
+			}
+		}
+	}
+	extractor.extract(result.mask, result.blobs, options.iBlobMode, options.minArea);
+}
@@ -0,0 +1,122 @@
+// Detection of colored blobs in the frames of a stream, without any global state.
+
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "PaletteFilter.h"
+#include "Blobs.h"
+#include "ThreadPool.h"
+#include "TilePipeline.h"
+#include "BlobTracker.h"
+#include "CoarseScanner.h"
+
+// what a detector does with each frame
+class cDetectorOptions {
+public:
+	bool bSmooth;			// blur the frames with smoothFrame() first (off if they come smoothed)
+	bool bUseLookupTable;	// threshold BGR with the lookup table of the detector instead of HSV; the
+							// first use allocates its 8 MB and builds a 48 MB cube shared by all and
+							// kept until exit
+	int iHighlightChannel;	// compose a highlight image (see HighlightMask()), -1 = off; palette
+							// colors are painted with their own hue
+	int iBlobMode;			// BLOBS_NONE, BLOBS_LARGEST or BLOBS_ALL
+	int minArea;			// minimum blob area
+	bool bTrack;			// follow the blobs from frame to frame (see cBlobTracker), not with a palette
+	int rescanInterval;		// frames between two scans of the whole frame when tracking
+	int coarseStride;		// > 1: find the blobs with a cCoarseScanner testing every coarseStride-th
+							// pixel first; not with highlighting, tracking or a palette
+	//! Constructor.
+	cDetectorOptions()
+		:bSmooth(false), bUseLookupTable(false), iHighlightChannel(-1), iBlobMode(BLOBS_ALL), minArea(0)
+		,bTrack(false), rescanInterval(DEFAULT_RESCAN_INTERVAL), coarseStride(0)
+	{}
+};
+
+// results of a detector on one frame; the buffers are reused if the same object is
+// passed again
+class cDetection {
+public:
+	int frame;					// index of the frame in its stream
+	cv::Mat mask;				// filtered pixels (0 or 255); not set by coarse scans, and only if
+								// highlighted when tracking
+	cv::Mat highlight;			// highlight image, if iHighlightChannel >= 0
+	cv::Mat labels;				// with a palette: 0 = no color, i+1 = palette[i]
+	std::vector<int> counts;	// with a palette: number of pixels with each label
+	std::vector<cBlob> blobs;	// blobs found (when tracking: the tracked blobs seen on the frame)
+	std::vector<int> ids;		// when tracking: the track identity of each blob
+	std::vector<cTrack> tracks;	// when tracking: all tracks, including the ones missing on the frame
+	double windowfraction;		// coarse scans: part of the frame filtered at full resolution
+								// around the grid hits (1 = the whole frame)
+	//! Constructor.
+	cDetection()
+		:frame(-1), windowfraction(1)
+	{}
+	// exchange results and buffers with another detection
+	void swap(cDetection &other);
+};
+
+// Finds the blobs of a color, or classifies the pixels with a palette of colors, on the
+// frames of one stream. All state (settings, lookup table, tracks, buffers) belongs to the
+// object, so any number of detectors can run at the same time, e.g. one for each camera.
+// Settings can be changed from any thread, a frame is detected with the settings at the
+// time it is started. Frames given to one detector are detected one after the other.
+// The bands of a frame are filtered on the threads of a pool, which can be shared by
+// several detectors: their frames then take turns on all threads.
+class cHSVDetector {
+public:
+	//! Constructor.
+	explicit cHSVDetector(cThreadPool &pool);
+	void setColor(const cColor &color);
+	cColor getColor() const;
+	// classify with all colors of a palette instead of one color (empty = use the color);
+	// earlier colors win where ranges overlap
+	void setPalette(const std::vector<cColor> &palette);
+	void setOptions(const cDetectorOptions &options);
+	cDetectorOptions getOptions() const;
+	// Detect a BGR frame. srcHSV is its HSV version (of the smoothed frame if bSmooth is
+	// set), or empty to convert it band by band. Frames are numbered within the stream:
+	// tracks are only continued to the frame after the previous one, and a frame detected
+	// again with the same color keeps its tracks. Returns false if cancel was set before
+	// it was finished, the results are incomplete then.
+	bool detect(int frame, const cv::Mat &srcBGR, const cv::Mat &srcHSV, cDetection &result,
+		const std::atomic<bool> *cancel = 0);
+	// forget the tracked blobs, the next frame is scanned as a whole
+	void reset();
+private:
+	void detectPalette(const cv::Mat &srcBGR, const cv::Mat &srcHSV, const cDetectorOptions &options,
+		cDetection &result);
+	void detectTracks(int frame, const cv::Mat &srcBGR, const cColor &color, const cDetectorOptions &options,
+		cDetection &result);
+	void detectCoarse(const cv::Mat &srcBGR, const cColor &color, const cDetectorOptions &options,
+		cDetection &result);
+	// settings
+	mutable std::mutex settingsmutex;
+	cColor color;
+	std::vector<cColor> palette;
+	cDetectorOptions options;
+	// state of detection
+	std::mutex detectmutex;		// one frame at a time
+	cTilePipeline pipeline;
+	cHSVLookupTable lookuptable;
+	cPaletteFilter palettefilter;
+	cBlobTracker tracker;
+	cCoarseScanner coarse;
+	int trackframe;				// frame the tracks belong to
+	cColor trackcolor;			// color the tracks were found with
+	std::vector<cColor> currentpalette;	// palette of the frame being detected
+	cv::Mat smoothed, hsv;		// frame buffers of palette mode
+	cv::Mat rowbuffer;			// row sums of its blur
+	cv::Mat smoothedunused;		// dstSmoothed of the pipeline, not kept
+	cv::Mat labelcolorsHSV, labelcolors;	// color of each palette label
+	cBlobExtractor extractor;	// blobs of palette mode
+};
+
+#endif
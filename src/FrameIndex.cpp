@@ -0,0 +1,190 @@
+// Random access to video frames: seek point index, decoded frame cache and seeking.
+
+#include <algorithm>
+
+#include "FrameIndex.h"
+#include "TilePipeline.h"
+
+uint64_t hashFrame(const cv::Mat &image) {
+	// FNV-1a
+	uint64_t h = 14695981039346656037ULL;
+	size_t rowbytes = image.cols * image.elemSize();
+	for (int y = 0; y < image.rows; y++) {
+		const uchar *p = image.ptr<uchar>(y);
+		for (size_t x = 0; x < rowbytes; x++) {
+			h = (h ^ p[x]) * 1099511628211ULL;
+		}
+	}
+	return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cFrameIndex
+
+cFrameIndex::cFrameIndex()
+	:framecount(0), bReady(false), bStop(false)
+{}
+
+cFrameIndex::~cFrameIndex() {
+	stop();
+}
+
+void cFrameIndex::build(const std::string &filename, int interval) {
+	stop();
+	bReady = false;
+	bStop = false;
+	builder = std::thread(&cFrameIndex::run, this, filename, interval);
+}
+
+void cFrameIndex::stop() {
+	bStop = true;
+	if (builder.joinable()) {
+		builder.join();
+	}
+}
+
+int cFrameIndex::getFrameCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return framecount;
+}
+
+int cFrameIndex::getSeekPoint(int frame) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<int>::const_iterator it = std::upper_bound(seekpoints.begin(), seekpoints.end(), frame);
+	if (it == seekpoints.begin()) return 0;
+	return *(--it);
+}
+
+void cFrameIndex::run(std::string filename, int interval) {
+	cv::VideoCapture video;
+	cv::Mat image;
+	std::vector<int> candidates;
+	std::vector<uint64_t> hashes;
+	std::vector<int> trusted;
+	int frame = 0;
+
+	if (!video.open(filename)) return;
+	if (interval < 1) interval = 1;
+
+	// sequential pass: count frames, hash the candidates
+	while (!bStop && video.grab()) {
+		if (frame && frame % interval == 0) {
+			if (!video.retrieve(image) || image.empty()) break;
+			candidates.push_back(frame);
+			hashes.push_back(hashFrame(image));
+		}
+		frame++;
+	}
+	if (bStop) return;
+
+	// check the candidates
+	for (unsigned int i = 0; i < candidates.size() && !bStop; i++) {
+		if (video.set(cv::CAP_PROP_POS_FRAMES, candidates[i]) &&
+			video.read(image) && !image.empty() && hashFrame(image) == hashes[i])
+		{
+			trusted.push_back(candidates[i]);
+		}
+	}
+	if (bStop) return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	framecount = frame;
+	seekpoints.swap(trusted);
+	bReady = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cFrameCache
+
+cFrameCache::cFrameCache(size_t maxbytes)
+	:bytes(0), maxbytes(maxbytes)
+{}
+
+bool cFrameCache::get(int frame, cv::Mat &dst) {
+	std::map<int, tEntries::iterator>::iterator it = lookup.find(frame);
+	if (it == lookup.end()) return false;
+	// move to front
+	entries.splice(entries.begin(), entries, it->second);
+	it->second->second.copyTo(dst);
+	return true;
+}
+
+void cFrameCache::put(int frame, const cv::Mat &image) {
+	size_t size = image.total() * image.elemSize();
+	if (size > maxbytes) return;
+	std::map<int, tEntries::iterator>::iterator it = lookup.find(frame);
+	if (it != lookup.end()) {
+		// already cached, just refresh
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+	// evict least recently used, reuse its buffer if possible
+	cv::Mat buffer;
+	while (!entries.empty() && bytes + size > maxbytes) {
+		const cv::Mat &old = entries.back().second;
+		bytes -= old.total() * old.elemSize();
+		buffer = old;
+		lookup.erase(entries.back().first);
+		entries.pop_back();
+	}
+	image.copyTo(buffer);
+	entries.push_front(std::make_pair(frame, buffer));
+	lookup[frame] = entries.begin();
+	bytes += size;
+}
+
+void cFrameCache::clear() {
+	entries.clear();
+	lookup.clear();
+	bytes = 0;
+}
+
+void cFrameCache::setMaxBytes(size_t maxbytes) {
+	this->maxbytes = maxbytes;
+	while (!entries.empty() && bytes > maxbytes) {
+		const cv::Mat &old = entries.back().second;
+		bytes -= old.total() * old.elemSize();
+		lookup.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cFrameSeeker
+
+cFrameSeeker::cFrameSeeker(cv::VideoCapture &video, const std::string &filename,
+	const cFrameIndex *index, cFrameCache *cache)
+	:position(0), video(video), filename(filename), index(index), cache(cache)
+{}
+
+bool cFrameSeeker::read(int frame, cv::Mat &dst) {
+	cv::Mat rawframe, image, rowbuffer;
+
+	if (frame < 0) return false;
+	if (cache && cache->get(frame, dst)) return true;
+
+	// decode forward from the current position if no seek point is closer
+	int seekpoint = index ? index->getSeekPoint(frame) : 0;
+	if (position > frame || position < seekpoint) {
+		if (seekpoint > 0 && video.set(cv::CAP_PROP_POS_FRAMES, seekpoint)) {
+			position = seekpoint;
+		} else {
+			// frame 0 is always reachable by reopening
+			video.release();
+			if (!video.open(filename)) return false;
+			position = 0;
+		}
+	}
+
+	while (position <= frame) {
+		if (!video.read(rawframe) || rawframe.empty()) return false;
+		position++;
+		// smooth the requested frame, and all others on the way if they are cached
+		if (position - 1 == frame || cache) {
+			smoothFrame(rawframe, image, rowbuffer);
+			if (cache) cache->put(position - 1, image);
+		}
+	}
+	image.copyTo(dst);
+	return true;
+}
@@ -0,0 +1,93 @@
+// Random access to video frames: seek point index, decoded frame cache and seeking.
+
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+const int SEEKPOINT_INTERVAL = 100;				// candidate seek points are checked every this many frames
+const size_t DEFAULT_FRAMECACHE_MB = 256;		// default memory limit of decoded frame cache
+
+// Index of the positions where the video can be seeked to reliably, built once in the background.
+// OpenCV does not expose keyframes, and seeking with CAP_PROP_POS_FRAMES lands on wrong
+// frames with some streams, so the whole video is decoded sequentially once on a separate
+// capture: frames are counted exactly, and a hash is stored for every candidate seek point.
+// A candidate is trusted only if seeking to it delivers the frame with the same hash.
+class cFrameIndex {
+public:
+	//! Constructor.
+	cFrameIndex();
+	//! Destructor.
+	~cFrameIndex();
+	// start building the index of a video file in the background
+	void build(const std::string &filename, int interval = SEEKPOINT_INTERVAL);
+	// stop building
+	void stop();
+	// is the index complete?
+	bool isReady() const {
+		return bReady;
+	}
+	// exact number of frames (only valid if ready)
+	int getFrameCount() const;
+	// largest trusted seek point at or before frame, 0 if none
+	int getSeekPoint(int frame) const;
+private:
+	void run(std::string filename, int interval);
+	std::vector<int> seekpoints;	// trusted seek points, sorted
+	int framecount;
+	std::atomic<bool> bReady;
+	std::atomic<bool> bStop;
+	mutable std::mutex mutex;
+	std::thread builder;
+};
+
+// Memory-capped least recently used cache of smoothed frames.
+class cFrameCache {
+public:
+	//! Constructor.
+	cFrameCache(size_t maxbytes = DEFAULT_FRAMECACHE_MB << 20);
+	// copy a cached frame into dst, returns false if not cached
+	bool get(int frame, cv::Mat &dst);
+	// store a copy of a frame, evicting least recently used frames if needed
+	void put(int frame, const cv::Mat &image);
+	void clear();
+	void setMaxBytes(size_t maxbytes);
+private:
+	typedef std::list<std::pair<int, cv::Mat> > tEntries;
+	tEntries entries;							// most recently used first
+	std::map<int, tEntries::iterator> lookup;	// frame -> entry
+	size_t bytes;
+	size_t maxbytes;
+};
+
+// Reads arbitrary frames of a video by decoding forward from the current position
+// or from the nearest trusted seek point, so it always lands on the exact frame.
+class cFrameSeeker {
+public:
+	//! Constructor.
+	cFrameSeeker(cv::VideoCapture &video, const std::string &filename,
+		const cFrameIndex *index = 0, cFrameCache *cache = 0);
+	// read the smoothed frame with the given index (counted from 0) into dst
+	bool read(int frame, cv::Mat &dst);
+	int position;	// index of the next frame the video delivers
+private:
+	cv::VideoCapture &video;
+	std::string filename;
+	const cFrameIndex *index;
+	cFrameCache *cache;
+};
+
+// hash of image content, used to recognize frames
+uint64_t hashFrame(const cv::Mat &image);
+
+#endif
@@ -0,0 +1,138 @@
+// Background decoding of video frames into a bounded ring buffer.
+
+#include <algorithm>
+
+#include "FramePrefetcher.h"
+#include "TilePipeline.h"
+#include "StageTimer.h"
+
+cFramePrefetcher::cFramePrefetcher()
+	:video(0), head(0), count(0), skip(0), skipped(0), position(0), bEnd(false), bStop(false)
+{}
+
+cFramePrefetcher::~cFramePrefetcher() {
+	stop();
+}
+
+void cFramePrefetcher::start(cv::VideoCapture &video, int depth, int position) {
+	stop();
+	if (depth < 1) depth = 1;
+	this->video = &video;
+	// preallocate slots with the frame size of the video
+	int width = (int)video.get(cv::CAP_PROP_FRAME_WIDTH);
+	int height = (int)video.get(cv::CAP_PROP_FRAME_HEIGHT);
+	slots.resize(depth);
+	hsvslots.resize(depth);
+	for (int i = 0; i < depth; i++) {
+		if (width > 0 && height > 0) {
+			slots[i].create(height, width, CV_8UC3);
+			hsvslots[i].create(height, width, CV_8UC3);
+		}
+	}
+	head = count = skip = skipped = 0;
+	this->position = position;
+	bEnd = bStop = false;
+	decoder = std::thread(&cFramePrefetcher::run, this);
+}
+
+int cFramePrefetcher::stop(cFrameCache *cache) {
+	if (decoder.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bStop = true;
+		}
+		notFull.notify_all();
+		decoder.join();
+	}
+	// the buffered frames are the ones right before the video position
+	if (cache) {
+		for (int i = 0; i < count; i++) {
+			cache->put(position - count + i, slots[(head + i) % (int)slots.size()]);
+		}
+	}
+	head = count = 0;
+	return position;
+}
+
+int cFramePrefetcher::next(cv::Mat &dst, cv::Mat &dstHSV, int n) {
+	std::unique_lock<std::mutex> lock(mutex);
+	int advanced = 0;
+	if (n < 1 || !decoder.joinable()) return 0;
+	// drop buffered frames that are skipped anyway
+	while (n - advanced > 1 && count > 0) {
+		head = (head + 1) % (int)slots.size();
+		count--;
+		advanced++;
+	}
+	// let the decoder skip the rest without smoothing them
+	skip = n - advanced - 1;
+	skipped = 0;
+	notFull.notify_one();
+	// wait for the frame
+	notEmpty.wait(lock, [this] { return count > 0 || bEnd; });
+	advanced += skipped;
+	skip = skipped = 0;
+	if (count == 0) {
+		return advanced;
+	}
+	// give the frame to the consumer, recycle its old buffer
+	cv::swap(dst, slots[head]);
+	cv::swap(dstHSV, hsvslots[head]);
+	head = (head + 1) % (int)slots.size();
+	count--;
+	notFull.notify_one();
+	return advanced + 1;
+}
+
+double cFramePrefetcher::get(int propId) {
+	std::lock_guard<std::mutex> lock(videomutex);
+	return video ? video->get(propId) : 0;
+}
+
+void cFramePrefetcher::run() {
+	cv::Mat rawframe;
+	int depth = (int)slots.size();
+	while (true) {
+		int tail;
+		bool bSkip;
+		// wait for a free slot
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this, depth] { return bStop || count < depth; });
+			if (bStop) return;
+			tail = (head + count) % depth;
+			bSkip = skip > 0;
+		}
+		// decode outside of the lock, the tail slot is not visible to the consumer yet
+		bool bOk;
+		{
+			STAGE_TIMER("decode");
+			std::lock_guard<std::mutex> lock(videomutex);
+			if (bSkip) {
+				bOk = video->grab();
+			} else {
+				bOk = video->read(rawframe) && !rawframe.empty();
+			}
+		}
+		if (bOk && !bSkip) {
+			STAGE_TIMER("blur");
+			smoothFrameHSV(rawframe, slots[tail], hsvslots[tail], rowbuffer);
+		}
+		// publish
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!bOk) {
+			bEnd = true;
+			notEmpty.notify_all();
+			return;
+		}
+		position++;
+		if (skip > 0) {
+			// frame was requested to be skipped while we were decoding it
+			skip--;
+			skipped++;
+		} else if (!bSkip) {
+			count++;
+			notEmpty.notify_one();
+		}
+	}
+}
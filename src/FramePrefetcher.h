@@ -0,0 +1,60 @@
+// Background decoding of video frames into a bounded ring buffer.
+
+#ifndef FRAMEPREFETCHER_H
+#define FRAMEPREFETCHER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "FrameIndex.h"
+
+const int DEFAULT_PREFETCH_DEPTH = 8; // default number of frames decoded ahead
+
+// Decodes frames on a separate thread ahead of the consumer into a fixed ring of
+// preallocated slots, with the gaussian smoothing and the HSV conversion already applied.
+// Getting the next frame swaps buffers with the ring instead of copying. Decoding pauses while the
+// ring is full, so memory use is bounded by the ring depth.
+class cFramePrefetcher {
+public:
+	//! Constructor.
+	cFramePrefetcher();
+	//! Destructor.
+	~cFramePrefetcher();
+	// start decoding ahead from an opened video, whose next frame has the given index;
+	// the video must not be used by anyone else until stop() is called
+	void start(cv::VideoCapture &video, int depth, int position = 0);
+	// stop decoding and drop all buffered frames (or move them to a cache);
+	// returns the index of the next frame the video delivers
+	int stop(cFrameCache *cache = 0);
+	// advance n frames and swap the last one into dst and its HSV version into dstHSV,
+	// waiting for it if needed; skipped frames are not smoothed. Returns the number of
+	// frames advanced, less than n at the end of the stream.
+	int next(cv::Mat &dst, cv::Mat &dstHSV, int n = 1);
+	// thread-safe query of a video property
+	double get(int propId);
+private:
+	void run();
+	cv::VideoCapture *video;
+	std::vector<cv::Mat> slots;	// ring buffer
+	std::vector<cv::Mat> hsvslots;	// HSV version of each slot
+	cv::Mat rowbuffer;			// row sums of the blur
+	int head;					// oldest decoded frame
+	int count;					// number of decoded frames in the ring
+	int skip;					// frames to skip before the next decoded one
+	int skipped;				// frames skipped so far
+	int position;				// index of the next frame the video delivers
+	bool bEnd;					// end of stream reached
+	bool bStop;					// decoder thread should exit
+	std::mutex mutex;			// guards the ring state
+	std::mutex videomutex;		// guards the video
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::thread decoder;
+};
+
+#endif
@@ -0,0 +1,120 @@
+// Sampling the color of a region on many frames of a video.
+
+#include <algorithm>
+#include <cmath>
+
+#include "FrameSampler.h"
+#include "RangeFit.h"
+
+// circular mean of the hues of an HSV image, in 0..180
+static double getMeanHue(const cv::Mat &srcHSV) {
+	double c = 0, s = 0;
+	for (int y = 0; y < srcHSV.rows; y++) {
+		const uchar *p = srcHSV.ptr<uchar>(y);
+		for (int x = 0; x < srcHSV.cols; x++, p += 3) {
+			double a = p[0] * (2 * CV_PI / 180);
+			c += cos(a);
+			s += sin(a);
+		}
+	}
+	double h = atan2(s, c) * (180 / (2 * CV_PI));
+	return h < 0 ? h + 180 : h;
+}
+
+// ratio of the pixels of an HSV image outside of a color range
+static double getClipped(const cv::Mat &srcHSV, const cColor &color) {
+	cHSVLimits l(color);
+	int n = 0;
+	for (int y = 0; y < srcHSV.rows; y++) {
+		const uchar *p = srcHSV.ptr<uchar>(y);
+		for (int x = 0; x < srcHSV.cols; x++, p += 3) {
+			if (!l.contains(p[0], p[1], p[2])) n++;
+		}
+	}
+	return srcHSV.total() ? (double)n / srcHSV.total() : 0;
+}
+
+void MergeColorRanges(const std::vector<cColor> &colors, cColor &merged) {
+	if (colors.empty()) return;
+	// hues covered by any of the ranges, exactly as cHSVLimits sees them
+	bool covered[180] = { false };
+	int Smin = 255, Smax = 0, Vmin = 255, Vmax = 0;
+	for (size_t i = 0; i < colors.size(); i++) {
+		cHSVLimits l(colors[i]);
+		for (int h = 0; h < 180; h++) {
+			if (l.containsH(h)) covered[h] = true;
+		}
+		Smin = std::min(Smin, l.Smin); Smax = std::max(Smax, l.Smax);
+		Vmin = std::min(Vmin, l.Vmin); Vmax = std::max(Vmax, l.Vmax);
+	}
+	// the hue range is the circle without its largest uncovered gap
+	int gap = 0, gapend = 0;
+	for (int i = 0, run = 0; i < 2 * 180; i++) {
+		if (covered[i % 180]) {
+			run = 0;
+		} else if (++run > gap && run <= 180) {
+			gap = run;
+			gapend = i % 180;
+		}
+	}
+	int lo = (gapend + 1) % 180;	// first covered hue after the gap
+	int width = 180 - gap;			// covered hues from lo on, including the small gaps between ranges
+	merged.rangeH = std::min(width / 2, 89);
+	merged.H = (lo + merged.rangeH) % 180;
+	merged.rangeS = (Smax - Smin + 1) / 2;
+	merged.S = Smin + merged.rangeS;
+	merged.rangeV = (Vmax - Vmin + 1) / 2;
+	merged.V = Vmin + merged.rangeV;
+}
+
+int SampleAcrossVideo(const std::string &filename, const cFrameIndex *index, const cFrameStore *store, int framecount,
+	int nframes, const cv::Rect &region, cThreadPool &pool,
+	std::vector<cFrameSample> &samples, cColor &merged)
+{
+	if (nframes < 1 || framecount < 1) return 0;
+	nframes = std::min(nframes, framecount);
+	samples.assign(nframes, cFrameSample());
+	for (int i = 0; i < nframes; i++) {
+		// the middle of nframes equal parts of the video
+		samples[i].frame = (int)(((long long)2 * i + 1) * framecount / (2 * nframes));
+	}
+
+	// each worker decodes forward through a consecutive run of the sampled frames
+	int workers = std::max(1, std::min(nframes, pool.size()));
+	pool.parallelFor(workers, [&](int w) {
+		cv::VideoCapture video;
+		if (!store && !video.open(filename)) return;
+		cFrameSeeker seeker(video, filename, index);
+		cv::Mat image, hsv;
+		for (int i = nframes * w / workers; i < nframes * (w + 1) / workers; i++) {
+			cFrameSample &sample = samples[i];
+			if (store) {
+				hsv.release();
+				if (!store->get(sample.frame, image, &hsv)) break;
+			} else {
+				if (!seeker.read(sample.frame, image)) break;
+			}
+			cv::Rect r = region & cv::Rect(0, 0, image.cols, image.rows);
+			if (r.area() <= 0) continue;
+			if (!hsv.empty()) {
+				hsv(r).copyTo(sample.hsv);
+			} else {
+				cv::cvtColor(image(r), sample.hsv, cv::COLOR_BGR2HSV);
+			}
+			sample.pixels = FitColorRange(sample.color, sample.hsv, cv::Mat(), DEFAULT_FIT_PERCENTILE);
+			sample.meanH = getMeanHue(sample.hsv);
+			sample.bRead = true;
+		}
+	});
+
+	// one range for all frames
+	std::vector<cColor> colors;
+	for (int i = 0; i < nframes; i++) {
+		if (samples[i].bRead) colors.push_back(samples[i].color);
+	}
+	MergeColorRanges(colors, merged);
+	for (int i = 0; i < nframes; i++) {
+		if (samples[i].bRead) samples[i].clipped = getClipped(samples[i].hsv, merged);
+	}
+	return (int)colors.size();
+}
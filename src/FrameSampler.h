@@ -0,0 +1,47 @@
+// Sampling the color of a region on many frames of a video.
+
+#ifndef FRAMESAMPLER_H
+#define FRAMESAMPLER_H
+
+#include <string>
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "FrameIndex.h"
+#include "FrameStore.h"
+#include "ThreadPool.h"
+
+const int DEFAULT_SAMPLE_FRAMES = 16;	// frames sampled through the video
+
+// the color of the sampled region on one frame
+class cFrameSample {
+public:
+	int frame;			// frame index, counted from 0
+	bool bRead;			// could the frame be read?
+	cColor color;		// range fitted to the region on this frame
+	double meanH;		// circular mean of the hues of the region
+	int pixels;			// number of pixels of the region
+	double clipped;		// ratio of the pixels outside of the merged range
+	cv::Mat hsv;		// the region in HSV
+	//! Constructor.
+	cFrameSample()
+		:frame(0),bRead(false),meanH(0),pixels(0),clipped(0)
+	{}
+};
+
+// Read nframes frames spread evenly through a video of framecount frames, and fit a color
+// range to a region on each. Frames are decoded in parallel on the threads of the pool,
+// each with its own capture, or taken from a frame store if given. The per-frame ranges are merged into one that covers all of
+// them (hue circular), and the ratio of pixels it misses is found for each frame.
+// Returns the number of frames read.
+int SampleAcrossVideo(const std::string &filename, const cFrameIndex *index, const cFrameStore *store, int framecount,
+	int nframes, const cv::Rect &region, cThreadPool &pool,
+	std::vector<cFrameSample> &samples, cColor &merged);
+
+// the smallest range covering all ranges, hue ranges are joined around the circle
+void MergeColorRanges(const std::vector<cColor> &colors, cColor &merged);
+
+#endif
@@ -0,0 +1,225 @@
+// Decoded frames of a video stored in a file, read back through a memory mapping.
+
+#include <cstring>	// Used for "memcmp", "memcpy", "strncpy"
+#include <cstdio>	// Used for "remove", "rename"
+#include <fstream>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>	// Used for "stat"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "FrameStore.h"
+#include "TilePipeline.h"
+
+// bytes of one frame in the store, with padding to the next frame
+static uint64_t getFrameBytes(const tFrameStoreHeader &h) {
+	uint64_t bytes = (uint64_t)h.width * h.height * 3 * ((h.flags & FRAMESTORE_HSV) ? 2 : 1);
+	return (bytes + FRAMESTORE_ALIGN - 1) / FRAMESTORE_ALIGN * FRAMESTORE_ALIGN;
+}
+
+// size and modification time of a file, false if it is not a file
+static bool getFileInfo(const std::string &filename, uint64_t &size, int64_t &time) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st) || !(st.st_mode & _S_IFREG)) return false;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) || !S_ISREG(st.st_mode)) return false;
+#endif
+	size = (uint64_t)st.st_size;
+	time = (int64_t)st.st_mtime;
+	return true;
+}
+
+// do two names refer to the same existing file?
+static bool isSameFile(const std::string &a, const std::string &b) {
+#ifdef _WIN32
+	char fulla[MAX_PATH], fullb[MAX_PATH];
+	uint64_t size;
+	int64_t time;
+	return getFileInfo(a, size, time) && GetFullPathNameA(a.c_str(), MAX_PATH, fulla, 0) &&
+		GetFullPathNameA(b.c_str(), MAX_PATH, fullb, 0) && !_stricmp(fulla, fullb);
+#else
+	struct stat sa, sb;
+	return !stat(a.c_str(), &sa) && !stat(b.c_str(), &sb) && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+static bool writeRows(std::ofstream &out, const cv::Mat &image) {
+	for (int y = 0; y < image.rows; y++) {
+		out.write((const char*)image.ptr<uchar>(y), image.cols * image.elemSize());
+	}
+	return out.good();
+}
+
+int cFrameStore::build(const std::string &videofile, const std::string &storefile, bool bHSV,
+	void (*progress)(int frames))
+{
+	if (!canReplace(storefile, videofile)) return -1;
+	cv::VideoCapture video;
+	if (!video.open(videofile)) return -1;
+	// written under another name first, so that a broken build is never opened
+	std::string partfile = storefile + ".part";
+	std::ofstream out(partfile.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) return -1;
+
+	tFrameStoreHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FRAMESTORE_MAGIC, sizeof(h.magic));
+	h.version = FRAMESTORE_VERSION;
+	h.flags = bHSV ? FRAMESTORE_HSV : 0;
+	if (!getFileInfo(videofile, h.sourcesize, h.sourcetime)) {
+		h.sourcesize = 0;
+		h.sourcetime = 0;
+	}
+	strncpy(h.source, videofile.c_str(), sizeof(h.source) - 1);
+	std::vector<uint64_t> offsets;
+	std::vector<char> padding(FRAMESTORE_ALIGN, 0);
+	out.write(padding.data(), FRAMESTORE_ALIGN); // header, written again at the end
+	uint64_t offset = FRAMESTORE_ALIGN;
+
+	cv::Mat rawframe, image, hsv, rowbuffer;
+	bool bOk = true;
+	while (bOk && video.read(rawframe) && !rawframe.empty()) {
+		if (offsets.empty()) {
+			h.width = rawframe.cols;
+			h.height = rawframe.rows;
+		} else if (rawframe.cols != h.width || rawframe.rows != h.height || rawframe.type() != CV_8UC3) {
+			bOk = false;
+			break;
+		}
+		if (bHSV) {
+			smoothFrameHSV(rawframe, image, hsv, rowbuffer);
+		} else {
+			smoothFrame(rawframe, image, rowbuffer);
+		}
+		offsets.push_back(offset);
+		bOk = writeRows(out, image) && (!bHSV || writeRows(out, hsv));
+		uint64_t bytes = getFrameBytes(h);
+		uint64_t used = (uint64_t)image.total() * image.elemSize() * (bHSV ? 2 : 1);
+		out.write(padding.data(), (std::streamsize)(bytes - used));
+		offset += bytes;
+		if (progress && offsets.size() % FRAMESTORE_PROGRESS == 0) progress((int)offsets.size());
+	}
+	h.framecount = (int32_t)offsets.size();
+	h.tableoffset = offset;
+	if (!offsets.empty()) out.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+	out.seekp(0);
+	out.write((const char*)&h, sizeof(h));
+	out.close();
+	if (!bOk || !out || offsets.empty()) {
+		remove(partfile.c_str());
+		return -1;
+	}
+	remove(storefile.c_str());
+	if (rename(partfile.c_str(), storefile.c_str())) return -1;
+	return h.framecount;
+}
+
+bool cFrameStore::canReplace(const std::string &storefile, const std::string &videofile) {
+	if (isSameFile(storefile, videofile)) return false;
+	std::ifstream in(storefile.c_str(), std::ios::binary);
+	if (!in) return true; // nothing to lose
+	char magic[sizeof(FRAMESTORE_MAGIC)];
+	return in.read(magic, sizeof(magic)) && !memcmp(magic, FRAMESTORE_MAGIC, sizeof(magic));
+}
+
+cFrameStore::cFrameStore()
+	:base(0), size(0), table(0)
+#ifdef _WIN32
+	,file(INVALID_HANDLE_VALUE), mapping(0)
+#endif
+{
+	memset(&header, 0, sizeof(header));
+}
+
+cFrameStore::~cFrameStore() {
+	close();
+}
+
+bool cFrameStore::open(const std::string &storefile) {
+	close();
+	// map it copy on write, frames given out can be written into without changing the file
+#ifdef _WIN32
+	file = CreateFileA(storefile.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER filesize;
+	if (GetFileSizeEx(file, &filesize) && filesize.QuadPart >= (LONGLONG)sizeof(header)) {
+		size = (uint64_t)filesize.QuadPart;
+		mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+		if (mapping) base = (uchar*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	}
+#else
+	int fd = ::open(storefile.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (!fstat(fd, &st) && (uint64_t)st.st_size >= sizeof(header)) {
+		size = (uint64_t)st.st_size;
+		void *p = mmap(0, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) base = (uchar*)p;
+	}
+	::close(fd); // the mapping keeps the file
+#endif
+	if (!base) {
+		close();
+		return false;
+	}
+	// only the header is checked, frames are checked when they are read
+	memcpy(&header, base, sizeof(header));
+	if (memcmp(header.magic, FRAMESTORE_MAGIC, sizeof(header.magic)) || header.version != FRAMESTORE_VERSION ||
+		header.width <= 0 || header.height <= 0 || header.framecount <= 0 ||
+		header.tableoffset % sizeof(uint64_t) ||
+		header.tableoffset > size || (size - header.tableoffset) / sizeof(uint64_t) < (uint64_t)header.framecount)
+	{
+		close();
+		return false;
+	}
+	table = (const uint64_t*)(base + header.tableoffset);
+	header.source[sizeof(header.source) - 1] = 0;
+	return true;
+}
+
+bool cFrameStore::isMadeFrom(const std::string &videofile) const {
+	uint64_t size;
+	int64_t time;
+	if (!header.sourcesize || !getFileInfo(videofile, size, time)) {
+		return !header.sourcesize && videofile == header.source;
+	}
+	return size == header.sourcesize && time == header.sourcetime;
+}
+
+void cFrameStore::close() {
+#ifdef _WIN32
+	if (base) UnmapViewOfFile(base);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = 0;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (base) munmap(base, (size_t)size);
+#endif
+	base = 0;
+	size = 0;
+	table = 0;
+	memset(&header, 0, sizeof(header));
+}
+
+bool cFrameStore::get(int frame, cv::Mat &dst, cv::Mat *dstHSV) const {
+	if (!base || frame < 0 || frame >= header.framecount) return false;
+	uint64_t offset = table[frame];
+	if (offset > size || size - offset < getFrameBytes(header)) return false;
+	dst = cv::Mat(header.height, header.width, CV_8UC3, base + offset);
+	if (dstHSV && hasHSV()) {
+		*dstHSV = cv::Mat(header.height, header.width, CV_8UC3, base + offset + dst.total() * dst.elemSize());
+	}
+	return true;
+}
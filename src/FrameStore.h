@@ -0,0 +1,89 @@
+// Decoded frames of a video stored in a file, read back through a memory mapping.
+
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include <string>
+#include <cstdint>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+const char FRAMESTORE_MAGIC[8] = { 'C', 'W', 'H', 'S', 'V', 'F', 'S', 0 };
+const uint32_t FRAMESTORE_VERSION = 2;
+const uint32_t FRAMESTORE_HSV = 1;		// header flag: each frame is followed by its HSV version
+const int FRAMESTORE_ALIGN = 4096;		// frames start at multiples of this (page size)
+const int FRAMESTORE_PROGRESS = 1000;	// frames between progress reports of building a store
+const int FRAMESTORE_SOURCE_LENGTH = 1024;	// bytes of the video file name in the header
+
+// header at the start of a store file, in host byte order
+struct tFrameStoreHeader {
+	char magic[8];			// FRAMESTORE_MAGIC
+	uint32_t version;		// FRAMESTORE_VERSION
+	uint32_t flags;			// FRAMESTORE_HSV or 0
+	int32_t width;
+	int32_t height;
+	int32_t framecount;
+	int32_t reserved;
+	uint64_t tableoffset;	// file offset of framecount uint64_t frame offsets
+	// the video the store was made from
+	uint64_t sourcesize;	// file size, 0 if it is not a file (e.g. a stream)
+	int64_t sourcetime;		// modification time of the file (seconds since 1970)
+	char source[FRAMESTORE_SOURCE_LENGTH];	// file name as given, 0 terminated
+};
+
+// A video decoded once into a file: smoothed BGR frames (like the prefetcher delivers
+// them) and optionally their HSV versions, after a small header and a table of frame
+// offsets. Opening only maps the file, so it takes the same time for any length, and
+// the pages of a frame are read from the disk when it is first used; no decoder is needed.
+class cFrameStore {
+public:
+	//! Constructor.
+	cFrameStore();
+	//! Destructor.
+	~cFrameStore();
+	// Decode a whole video into a store file, with the HSV frames if bHSV is set.
+	// The file appears only when it is complete. An existing file is only replaced if
+	// canReplace() allows it. progress (if given) is called with the number of frames
+	// written every FRAMESTORE_PROGRESS frames.
+	// Returns the number of frames stored, -1 on error.
+	static int build(const std::string &videofile, const std::string &storefile, bool bHSV,
+		void (*progress)(int frames) = 0);
+	// Can a store be built into this file? Only if it does not exist yet or is a store
+	// (of any version), and it is not the video itself.
+	static bool canReplace(const std::string &storefile, const std::string &videofile);
+	// map a store file, returns false if it is not a valid store
+	bool open(const std::string &storefile);
+	void close();
+	bool isOpen() const {
+		return base != 0;
+	}
+	int getFrameCount() const {
+		return header.framecount;
+	}
+	bool hasHSV() const {
+		return (header.flags & FRAMESTORE_HSV) != 0;
+	}
+	// name of the video the store was made from
+	std::string getSource() const {
+		return header.source;
+	}
+	// Was the store made from this video file as it is now (same size and modification
+	// time)? Videos that are not files are compared by name.
+	bool isMadeFrom(const std::string &videofile) const;
+	// Point dst (and dstHSV, if given and stored) to a frame (counted from 0) in the
+	// mapping, nothing is copied. Writing into them only changes the copy of this process.
+	// Returns false if the frame is not in the store.
+	bool get(int frame, cv::Mat &dst, cv::Mat *dstHSV = 0) const;
+private:
+	tFrameStoreHeader header;
+	uchar *base;			// start of the mapping, 0 if not open
+	uint64_t size;			// size of the file
+	const uint64_t *table;	// frame offsets
+#ifdef _WIN32
+	void *file;				// HANDLE of the file
+	void *mapping;			// HANDLE of the mapping
+#endif
+};
+
+#endif
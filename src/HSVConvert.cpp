@@ -0,0 +1,360 @@
+// Integer BGR -> HSV conversion kernels (AVX2, SSSE3 and scalar), meant to be bit-exact
+// with cv::cvtColor(COLOR_BGR2HSV). They compute the same fixed point formulas as OpenCV:
+// S = diff * round(255*4096 / V) >> 12 and H = h' * round(180*4096 / (6 * diff)) >> 12,
+// both rounded. The SIMD kernels get the two reciprocals with a float division instead
+// of a table lookup; the quotients are never closer than 1/510 to a rounding boundary,
+// so the rounded result is always the table value. All 2^24 colors were checked against
+// OpenCV 4.11.0 on every SIMD level; colorWheelHSV_bench --verify repeats this with the
+// OpenCV a build links (e.g. 3.x). The fused threshold keeps the planar H, S and V bytes
+// in registers and writes only the mask.
+
+#include <cstring>	// Used for "memset"
+
+#include "HSVConvert.h"
+#include "CpuFeatures.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+const int HSV_SHIFT = 12;	// fixed point bits of the OpenCV formulas
+
+// reciprocal tables of cv::cvtColor, 0 for 0
+class cDivTables {
+public:
+	int sdiv[256];	// round((255 << HSV_SHIFT) / v)
+	int hdiv[256];	// round((180 << HSV_SHIFT) / (6 * diff))
+	cDivTables() {
+		sdiv[0] = hdiv[0] = 0;
+		for (int i = 1; i < 256; i++) {
+			sdiv[i] = cvRound((255 << HSV_SHIFT) / (1. * i));
+			hdiv[i] = cvRound((180 << HSV_SHIFT) / (6. * i));
+		}
+	}
+};
+
+static const cDivTables divtables;
+
+static inline void convertPixel(const uchar *src, int &h, int &s, int &v) {
+	int b = src[0], g = src[1], r = src[2];
+	v = std::max(b, std::max(g, r));
+	int diff = v - std::min(b, std::min(g, r));
+	s = (diff * divtables.sdiv[v] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+	if (v == r) {
+		h = g - b;
+	} else if (v == g) {
+		h = b - r + 2 * diff;
+	} else {
+		h = r - g + 4 * diff;
+	}
+	h = (h * divtables.hdiv[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+	if (h < 0) h += 180;
+}
+
+// scalar versions, also used for the last pixels of a row
+static void convertRowScalar(uchar *dst, const uchar *src, int width) {
+	int h, s, v;
+	for (int x = 0; x < width; x++, src += 3, dst += 3) {
+		convertPixel(src, h, s, v);
+		dst[0] = (uchar)h;
+		dst[1] = (uchar)s;
+		dst[2] = (uchar)v;
+	}
+}
+
+static void filterRowScalar(uchar *dst, const uchar *src, int width, const cHSVLimits &l) {
+	int h, s, v;
+	for (int x = 0; x < width; x++, src += 3) {
+		convertPixel(src, h, s, v);
+		dst[x] = l.contains(h, s, v) ? 255 : 0;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+// shuffles between 16 interleaved pixels (48 bytes) and 16 bytes of each channel
+class cShuffleTables {
+public:
+	uchar planar[3][3][16];		// [channel][source vector]: bytes of the channel, 0x80 elsewhere
+	uchar packed[3][3][16];		// [target vector][channel]: bytes of the target from the channel
+	cShuffleTables() {
+		for (int c = 0; c < 3; c++) {
+			for (int k = 0; k < 3; k++) {
+				for (int i = 0; i < 16; i++) {
+					planar[c][k][i] = (3*i + c) / 16 == k ? (uchar)((3*i + c) % 16) : 0x80;
+					packed[k][c][i] = (16*k + i) % 3 == c ? (uchar)((16*k + i) / 3) : 0x80;
+				}
+			}
+		}
+	}
+};
+
+static const cShuffleTables shuffletables;
+
+// byte bounds of the fused threshold
+class cPlanarLimits {
+public:
+	uchar lo[3];
+	uchar hi[3];
+	bool bWrap;			// the hue interval wraps around
+	bool bEmpty;		// nothing can be in range
+	bool bValid;		// limits can be represented with bytes
+	cPlanarLimits(const cHSVLimits &l) {
+		int lo3[3] = { l.Hmin, l.Smin, l.Vmin };
+		int hi3[3] = { l.Hmax, l.Smax, l.Vmax };
+		bWrap = l.isHueWrapped();
+		// hue limits are always 0-179 for valid colors, otherwise use the scalar code
+		bValid = l.Hmin >= 0 && l.Hmin <= 255 && l.Hmax >= 0 && l.Hmax <= 255;
+		// empty saturation or value ranges, like cv::inRange handles them
+		bEmpty = false;
+		for (int c = 1; c < 3; c++) {
+			if (lo3[c] > hi3[c] || lo3[c] > 255 || hi3[c] < 0) bEmpty = true;
+			if (lo3[c] < 0) lo3[c] = 0;
+			if (hi3[c] > 255) hi3[c] = 255;
+		}
+		for (int c = 0; c < 3; c++) {
+			lo[c] = (uchar)lo3[c];
+			hi[c] = (uchar)hi3[c];
+		}
+	}
+};
+
+// split 16 BGR pixels into their channels
+TARGET_SSSE3
+static inline void loadPlanar(const uchar *src, __m128i &b, __m128i &g, __m128i &r) {
+	__m128i a[3], p[3];
+	for (int k = 0; k < 3; k++) a[k] = _mm_loadu_si128((const __m128i*)(src + 16*k));
+	for (int c = 0; c < 3; c++) {
+		p[c] = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(a[0], _mm_loadu_si128((const __m128i*)shuffletables.planar[c][0])),
+			_mm_shuffle_epi8(a[1], _mm_loadu_si128((const __m128i*)shuffletables.planar[c][1]))),
+			_mm_shuffle_epi8(a[2], _mm_loadu_si128((const __m128i*)shuffletables.planar[c][2])));
+	}
+	b = p[0];
+	g = p[1];
+	r = p[2];
+}
+
+// interleave 16 bytes of H, S and V into 16 HSV pixels
+TARGET_SSSE3
+static inline void storePacked(uchar *dst, __m128i h, __m128i s, __m128i v) {
+	for (int k = 0; k < 3; k++) {
+		__m128i p = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(h, _mm_loadu_si128((const __m128i*)shuffletables.packed[k][0])),
+			_mm_shuffle_epi8(s, _mm_loadu_si128((const __m128i*)shuffletables.packed[k][1]))),
+			_mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*)shuffletables.packed[k][2])));
+		_mm_storeu_si128((__m128i*)(dst + 16*k), p);
+	}
+}
+
+// 0xFF for the pixels of 16 planar H, S and V bytes inside the limits
+TARGET_SSSE3
+static inline __m128i testPlanar(__m128i h, __m128i s, __m128i v, const cPlanarLimits &p) {
+	__m128i hge = _mm_cmpeq_epi8(_mm_max_epu8(h, _mm_set1_epi8((char)p.lo[0])), h);
+	__m128i hle = _mm_cmpeq_epi8(_mm_min_epu8(h, _mm_set1_epi8((char)p.hi[0])), h);
+	__m128i sok = _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_max_epu8(s, _mm_set1_epi8((char)p.lo[1])), s),
+		_mm_cmpeq_epi8(_mm_min_epu8(s, _mm_set1_epi8((char)p.hi[1])), s));
+	__m128i vok = _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)p.lo[2])), v),
+		_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8((char)p.hi[2])), v));
+	// inside [lo,hi], or on either side of it for the wrapped hue
+	__m128i hok = p.bWrap ? _mm_or_si128(hge, hle) : _mm_and_si128(hge, hle);
+	return _mm_and_si128(hok, _mm_and_si128(sok, vok));
+}
+
+// round(k / max(x, 1)) for 32 bit lanes
+TARGET_SSSE3
+static inline __m128i reciprocalSSSE3(__m128 k, __m128i x) {
+	x = _mm_or_si128(x, _mm_srli_epi32(_mm_cmpeq_epi32(x, _mm_setzero_si128()), 31));
+	return _mm_cvtps_epi32(_mm_div_ps(k, _mm_cvtepi32_ps(x)));
+}
+
+// (x * q + 2048) >> 12 for 32 bit lanes with a signed 16 bit x and q < 2^24, with
+// 16 bit multiplies: q is split into q >> 12 and q & 4095
+TARGET_SSSE3
+static inline __m128i scaleSSSE3(__m128i x, __m128i q) {
+	__m128i hi = _mm_madd_epi16(x, _mm_srli_epi32(q, HSV_SHIFT));
+	__m128i lo = _mm_madd_epi16(x, _mm_and_si128(q, _mm_set1_epi32((1 << HSV_SHIFT) - 1)));
+	__m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(hi, HSV_SHIFT), lo), _mm_set1_epi32(1 << (HSV_SHIFT - 1)));
+	return _mm_srai_epi32(sum, HSV_SHIFT);
+}
+
+// convert 16 BGR pixels to planar H, S and V bytes
+TARGET_SSSE3
+static inline void convertBlockSSSE3(const uchar *src, __m128i &H, __m128i &S, __m128i &V) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 ks = _mm_set1_ps((float)(255 << HSV_SHIFT));
+	const __m128 kh = _mm_set1_ps((float)(180 << HSV_SHIFT) / 6);
+	__m128i b, g, r;
+	loadPlanar(src, b, g, r);
+	V = _mm_max_epu8(_mm_max_epu8(b, g), r);
+	__m128i diff = _mm_sub_epi8(V, _mm_min_epu8(_mm_min_epu8(b, g), r));
+	__m128i h16[2], s16[2];
+	for (int half = 0; half < 2; half++) {
+		__m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+		__m128i g16 = half ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+		__m128i r16 = half ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+		__m128i v16 = half ? _mm_unpackhi_epi8(V, zero) : _mm_unpacklo_epi8(V, zero);
+		__m128i d16 = half ? _mm_unpackhi_epi8(diff, zero) : _mm_unpacklo_epi8(diff, zero);
+		// hue before scaling, by the channel of the maximum (red first, then green)
+		__m128i vr = _mm_cmpeq_epi16(v16, r16);
+		__m128i vg = _mm_cmpeq_epi16(v16, g16);
+		__m128i d2 = _mm_add_epi16(d16, d16);
+		__m128i hr = _mm_sub_epi16(g16, b16);
+		__m128i hg = _mm_add_epi16(_mm_sub_epi16(b16, r16), d2);
+		__m128i hb = _mm_add_epi16(_mm_sub_epi16(r16, g16), _mm_add_epi16(d2, d2));
+		__m128i hn = _mm_or_si128(_mm_and_si128(vr, hr),
+			_mm_andnot_si128(vr, _mm_or_si128(_mm_and_si128(vg, hg), _mm_andnot_si128(vg, hb))));
+		__m128i h32[2], s32[2];
+		for (int q = 0; q < 2; q++) {
+			// the upper 16 bits of the lanes are ignored by scaleSSSE3()
+			__m128i v32 = q ? _mm_unpackhi_epi16(v16, zero) : _mm_unpacklo_epi16(v16, zero);
+			__m128i d32 = q ? _mm_unpackhi_epi16(d16, zero) : _mm_unpacklo_epi16(d16, zero);
+			__m128i hn32 = q ? _mm_unpackhi_epi16(hn, zero) : _mm_unpacklo_epi16(hn, zero);
+			s32[q] = scaleSSSE3(d32, reciprocalSSSE3(ks, v32));
+			__m128i h = scaleSSSE3(hn32, reciprocalSSSE3(kh, d32));
+			h32[q] = _mm_add_epi32(h, _mm_and_si128(_mm_cmplt_epi32(h, zero), _mm_set1_epi32(180)));
+		}
+		h16[half] = _mm_packs_epi32(h32[0], h32[1]);
+		s16[half] = _mm_packs_epi32(s32[0], s32[1]);
+	}
+	H = _mm_packus_epi16(h16[0], h16[1]);
+	S = _mm_packus_epi16(s16[0], s16[1]);
+}
+
+// the same with 8 pixels per vector and 32 bit multiplies
+TARGET_AVX2
+static inline void convertBlockAVX2(const uchar *src, __m128i &H, __m128i &S, __m128i &V) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i round = _mm256_set1_epi32(1 << (HSV_SHIFT - 1));
+	const __m256 ks = _mm256_set1_ps((float)(255 << HSV_SHIFT));
+	const __m256 kh = _mm256_set1_ps((float)(180 << HSV_SHIFT) / 6);
+	__m128i b, g, r;
+	loadPlanar(src, b, g, r);
+	V = _mm_max_epu8(_mm_max_epu8(b, g), r);
+	__m256i h32[2], s32[2];
+	for (int half = 0; half < 2; half++) {
+		__m256i b32 = _mm256_cvtepu8_epi32(half ? _mm_srli_si128(b, 8) : b);
+		__m256i g32 = _mm256_cvtepu8_epi32(half ? _mm_srli_si128(g, 8) : g);
+		__m256i r32 = _mm256_cvtepu8_epi32(half ? _mm_srli_si128(r, 8) : r);
+		__m256i v32 = _mm256_max_epi32(_mm256_max_epi32(b32, g32), r32);
+		__m256i d32 = _mm256_sub_epi32(v32, _mm256_min_epi32(_mm256_min_epi32(b32, g32), r32));
+		// hue before scaling, by the channel of the maximum (red first, then green)
+		__m256i vr = _mm256_cmpeq_epi32(v32, r32);
+		__m256i vg = _mm256_cmpeq_epi32(v32, g32);
+		__m256i d2 = _mm256_add_epi32(d32, d32);
+		__m256i hr = _mm256_sub_epi32(g32, b32);
+		__m256i hg = _mm256_add_epi32(_mm256_sub_epi32(b32, r32), d2);
+		__m256i hb = _mm256_add_epi32(_mm256_sub_epi32(r32, g32), _mm256_add_epi32(d2, d2));
+		__m256i hn = _mm256_blendv_epi8(_mm256_blendv_epi8(hb, hg, vg), hr, vr);
+		__m256i qs = _mm256_cvtps_epi32(_mm256_div_ps(ks, _mm256_cvtepi32_ps(_mm256_max_epi32(v32, one))));
+		__m256i qh = _mm256_cvtps_epi32(_mm256_div_ps(kh, _mm256_cvtepi32_ps(_mm256_max_epi32(d32, one))));
+		s32[half] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(d32, qs), round), HSV_SHIFT);
+		__m256i h = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(hn, qh), round), HSV_SHIFT);
+		h32[half] = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(zero, h), _mm256_set1_epi32(180)));
+	}
+	// packing works within 128 bit lanes, put the 64 bit quarters back in order
+	__m256i h16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(h32[0], h32[1]), 0xD8);
+	__m256i s16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(s32[0], s32[1]), 0xD8);
+	H = _mm_packus_epi16(_mm256_castsi256_si128(h16), _mm256_extracti128_si256(h16, 1));
+	S = _mm_packus_epi16(_mm256_castsi256_si128(s16), _mm256_extracti128_si256(s16, 1));
+}
+
+TARGET_SSSE3
+static void convertRowSSSE3(uchar *dst, const uchar *src, int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i h, s, v;
+		convertBlockSSSE3(src + x*3, h, s, v);
+		storePacked(dst + x*3, h, s, v);
+	}
+	convertRowScalar(dst + x*3, src + x*3, width - x);
+}
+
+TARGET_AVX2
+static void convertRowAVX2(uchar *dst, const uchar *src, int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i h, s, v;
+		convertBlockAVX2(src + x*3, h, s, v);
+		storePacked(dst + x*3, h, s, v);
+	}
+	convertRowScalar(dst + x*3, src + x*3, width - x);
+}
+
+TARGET_SSSE3
+static void filterRowSSSE3(uchar *dst, const uchar *src, int width, const cHSVLimits &l, const cPlanarLimits &p) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i h, s, v;
+		convertBlockSSSE3(src + x*3, h, s, v);
+		_mm_storeu_si128((__m128i*)(dst + x), testPlanar(h, s, v, p));
+	}
+	filterRowScalar(dst + x, src + x*3, width - x, l);
+}
+
+TARGET_AVX2
+static void filterRowAVX2(uchar *dst, const uchar *src, int width, const cHSVLimits &l, const cPlanarLimits &p) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i h, s, v;
+		convertBlockAVX2(src + x*3, h, s, v);
+		_mm_storeu_si128((__m128i*)(dst + x), testPlanar(h, s, v, p));
+	}
+	filterRowScalar(dst + x, src + x*3, width - x, l);
+}
+
+#endif
+
+void convertBGRToHSVRow(uchar *dst, const uchar *src, int width) {
+#ifdef HAVE_X86_SIMD
+	int level = getSIMDLevel();
+	if (level >= SIMD_AVX2) {
+		convertRowAVX2(dst, src, width);
+		return;
+	}
+	if (level >= SIMD_SSSE3) {
+		convertRowSSSE3(dst, src, width);
+		return;
+	}
+#endif
+	convertRowScalar(dst, src, width);
+}
+
+void convertBGRToHSV(const cv::Mat &srcBGR, cv::Mat &dstHSV) {
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	dstHSV.create(srcBGR.size(), CV_8UC3);
+	int rows = srcBGR.rows;
+	int cols = srcBGR.cols;
+	if (srcBGR.isContinuous() && dstHSV.isContinuous()) {
+		cols *= rows;
+		rows = 1;
+	}
+	for (int y = 0; y < rows; y++) {
+		convertBGRToHSVRow(dstHSV.ptr<uchar>(y), srcBGR.ptr<uchar>(y), cols);
+	}
+}
+
+void filterBGRRow(uchar *dst, const uchar *src, int width, const cHSVLimits &limits) {
+#ifdef HAVE_X86_SIMD
+	int level = getSIMDLevel();
+	if (level >= SIMD_SSSE3) {
+		cPlanarLimits p(limits);
+		if (p.bEmpty) {
+			memset(dst, 0, width);
+			return;
+		}
+		if (p.bValid) {
+			if (level >= SIMD_AVX2) {
+				filterRowAVX2(dst, src, width, limits, p);
+			} else {
+				filterRowSSSE3(dst, src, width, limits, p);
+			}
+			return;
+		}
+	}
+#endif
+	filterRowScalar(dst, src, width, limits);
+}
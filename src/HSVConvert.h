@@ -0,0 +1,23 @@
+// Integer BGR -> HSV conversion kernels, same result as cv::cvtColor(COLOR_BGR2HSV)
+// (checked with colorWheelHSV_bench --verify).
+
+#ifndef HSVCONVERT_H
+#define HSVCONVERT_H
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+
+// convert one row of BGR pixels to HSV (AVX2, SSSE3 or scalar, chosen at runtime)
+void convertBGRToHSVRow(uchar *dst, const uchar *src, int width);
+
+// convert a BGR image to HSV on the calling thread
+void convertBGRToHSV(const cv::Mat &srcBGR, cv::Mat &dstHSV);
+
+// Threshold one row of BGR pixels with HSV limits without writing the HSV image: each
+// block of pixels is converted to planar H, S and V in registers and tested right away.
+// The result is the same as convertBGRToHSVRow() followed by filterHSVRow().
+void filterBGRRow(uchar *dst, const uchar *src, int width, const cHSVLimits &limits);
+
+#endif
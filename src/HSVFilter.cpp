@@ -0,0 +1,176 @@
+// HSV color ranges and the filters that threshold images with them.
+
+#include "HSVFilter.h"
+
+const int LUT_SIZE = 256 * 256 * 256;	// number of possible BGR colors
+const int LUT_BYTES = LUT_SIZE / 8;		// bit-packed table size (2 MB)
+
+cHSVLimits::cHSVLimits(const cColor &color) {
+	int x;
+
+	// Hue: 0-180, circular continuous
+	Hmin = Hmax = color.H;
+	x = color.rangeH; if (x>89) x = 89;
+	Hmax = (Hmax+x)%180;
+	Hmin = (Hmin+180-x)%180;
+
+	// Saturation: 0-255
+	Smin = Smax = color.S;
+	x = color.rangeS;
+	Smax += x; if (Smax>255) Smax = 255;
+	Smin -= x; if (Smin<0) Smin = 0;
+
+	// Value: 0-255
+	Vmin = Vmax = color.V;
+	x = color.rangeV;
+	Vmax += x; if (Vmax>255) Vmax = 255;
+	Vmin -= x; if (Vmin<0) Vmin = 0;
+}
+
+// input file type must be HSV 8-bit
+// output file type must be same size, binary 8-bit
+void cvFilterHSV(cv::Mat &dstBin, cv::Mat &srcHSV, const cColor &color) {
+	CV_Assert(srcHSV.type() == CV_8UC3);
+	cHSVLimits l(color);
+	int rows = srcHSV.rows;
+	int cols = srcHSV.cols;
+
+	// one fused pass, without temporaries for the wrapped hue
+	dstBin.create(srcHSV.size(), CV_8UC1);
+	if (srcHSV.isContinuous() && dstBin.isContinuous()) {
+		cols *= rows;
+		rows = 1;
+	}
+	for (int y = 0; y < rows; y++) {
+		filterHSVRow(dstBin.ptr<uchar>(y), srcHSV.ptr<uchar>(y), cols, l);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// source: http://www.shervinemami.info/blobs.html
+// input file type must be HSV 8-bit
+// output file type must be same size, binary 8-bit
+void cvFilterHSVInRange(cv::Mat &dstBin, cv::Mat &srcHSV, const cColor &color) {
+	cHSVLimits l(color);
+
+	// threshold H plane
+	if (!l.isHueWrapped())
+		cv::inRange(srcHSV, cv::Scalar(l.Hmin,l.Smin,l.Vmin), cv::Scalar(l.Hmax,l.Smax,l.Vmax), dstBin);
+	else
+	{
+        cv::Mat tmp;
+		cv::inRange(srcHSV, cv::Scalar(l.Hmin,l.Smin,l.Vmin), cv::Scalar(255,l.Smax,l.Vmax), dstBin);
+		cv::inRange(srcHSV, cv::Scalar(0,l.Smin,l.Vmin), cv::Scalar(l.Hmax,l.Smax,l.Vmax), tmp);
+		cv::bitwise_or(tmp, dstBin, dstBin);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HSV value of all 256^3 BGR colors in planar layout, indexed by (B<<16)|(G<<8)|R.
+// Computed once with cv::cvtColor itself, so that the lookup table reproduces
+// its rounding exactly. Takes 48 MB, allocated on first use of a lookup table and
+// kept until the process exits.
+class cHSVCube {
+public:
+	std::vector<uchar> H, S, V;
+	cHSVCube() : H(LUT_SIZE), S(LUT_SIZE), V(LUT_SIZE) {
+		cv::Mat slice(256, 256, CV_8UC3), sliceHSV;
+		for (int b = 0; b < 256; b++) {
+			// all G,R combinations for this B value
+			for (int g = 0; g < 256; g++) {
+				uchar *p = slice.ptr<uchar>(g);
+				for (int r = 0; r < 256; r++) {
+					p[r*3 + 0] = (uchar)b;
+					p[r*3 + 1] = (uchar)g;
+					p[r*3 + 2] = (uchar)r;
+				}
+			}
+			cv::cvtColor(slice, sliceHSV, cv::COLOR_BGR2HSV);
+			// store it planar
+			for (int g = 0; g < 256; g++) {
+				const uchar *p = sliceHSV.ptr<uchar>(g);
+				int i = (b << 16) | (g << 8);
+				for (int r = 0; r < 256; r++, i++) {
+					H[i] = p[r*3 + 0];
+					S[i] = p[r*3 + 1];
+					V[i] = p[r*3 + 2];
+				}
+			}
+		}
+	}
+};
+
+static const cHSVCube &getHSVCube() {
+	static const cHSVCube cube; // thread-safe lazy initialization
+	return cube;
+}
+
+cHSVLookupTable::cHSVLookupTable()
+	:limits(cColor()), bCompiled(false)
+{}
+
+// pack accept[cube[i]] for all BGR colors into a bit plane
+void cHSVLookupTable::buildPlane(std::vector<uchar> &plane, const uchar *cube, const bool *accept) {
+	for (int i = 0; i < LUT_BYTES; i++) {
+		const uchar *c = cube + i*8;
+		plane[i] = (uchar)(
+			(accept[c[0]] << 0) | (accept[c[1]] << 1) | (accept[c[2]] << 2) | (accept[c[3]] << 3) |
+			(accept[c[4]] << 4) | (accept[c[5]] << 5) | (accept[c[6]] << 6) | (accept[c[7]] << 7));
+	}
+}
+
+void cHSVLookupTable::update(const cColor &color) {
+	const cHSVCube &cube = getHSVCube();
+	cHSVLimits l(color);
+	bool accept[256];
+	bool bChanged = false;
+	int i;
+
+	// the tables are only allocated when first compiled, unused tables cost nothing
+	if (!bCompiled) {
+		bits.resize(LUT_BYTES);
+		bitsH.resize(LUT_BYTES);
+		bitsS.resize(LUT_BYTES);
+		bitsV.resize(LUT_BYTES);
+	}
+	// Hue
+	if (!bCompiled || l.Hmin != limits.Hmin || l.Hmax != limits.Hmax) {
+		for (i = 0; i < 256; i++) accept[i] = l.containsH(i);
+		buildPlane(bitsH, &cube.H[0], accept);
+		bChanged = true;
+	}
+	// Saturation
+	if (!bCompiled || l.Smin != limits.Smin || l.Smax != limits.Smax) {
+		for (i = 0; i < 256; i++) accept[i] = l.containsS(i);
+		buildPlane(bitsS, &cube.S[0], accept);
+		bChanged = true;
+	}
+	// Value
+	if (!bCompiled || l.Vmin != limits.Vmin || l.Vmax != limits.Vmax) {
+		for (i = 0; i < 256; i++) accept[i] = l.containsV(i);
+		buildPlane(bitsV, &cube.V[0], accept);
+		bChanged = true;
+	}
+	// combine components
+	if (bChanged) {
+		for (i = 0; i < LUT_BYTES; i++) {
+			bits[i] = bitsH[i] & bitsS[i] & bitsV[i];
+		}
+	}
+	limits = l;
+	bCompiled = true;
+}
+
+void cHSVLookupTable::filter(cv::Mat &dstBin, const cv::Mat &srcBGR) const {
+	CV_Assert(bCompiled && srcBGR.type() == CV_8UC3);
+	const uchar *table = &bits[0];
+	dstBin.create(srcBGR.size(), CV_8UC1);
+	for (int y = 0; y < srcBGR.rows; y++) {
+		const uchar *s = srcBGR.ptr<uchar>(y);
+		uchar *d = dstBin.ptr<uchar>(y);
+		for (int x = 0; x < srcBGR.cols; x++, s += 3) {
+			unsigned int i = ((unsigned int)s[0] << 16) | ((unsigned int)s[1] << 8) | s[2];
+			d[x] = (uchar)(0 - ((table[i >> 3] >> (i & 7)) & 1));
+		}
+	}
+}
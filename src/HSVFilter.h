@@ -0,0 +1,118 @@
+// HSV color ranges and the filters that threshold images with them.
+
+#ifndef HSVFILTER_H
+#define HSVFILTER_H
+
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+// a particle (chip/bin or total ID)
+class cColor {
+public:
+	int H;
+	int S;
+	int V;
+	int rangeH;
+	int rangeS;
+	int rangeV;
+	//! Constructor.
+	cColor()
+		:H(90),S(240),V(200)
+		,rangeH(10),rangeS(50),rangeV(50)
+	{}
+	// overloading 'Equal To' operator
+	bool operator==(const cColor &other) const {
+		if (this->H == other.H &&
+			this->S == other.S &&
+			this->V == other.V &&
+			this->rangeH == other.rangeH &&
+			this->rangeS == other.rangeS &&
+			this->rangeV == other.rangeV)
+			return true;
+		else
+			return false;
+	}
+	// overloading 'Not Equal To' operator
+	bool operator!=(const cColor &other) const {
+		return !(*this == other);
+	}
+};
+
+// Inclusive channel limits of a cColor, exactly as cvFilterHSV() passes them to cv::inRange.
+// Hue is circular: if Hmax < Hmin, the range wraps around 180.
+class cHSVLimits {
+public:
+	int Hmin, Hmax;
+	int Smin, Smax;
+	int Vmin, Vmax;
+	//! Constructor.
+	cHSVLimits(const cColor &color);
+	// is the hue range wrapped around 0/180?
+	bool isHueWrapped() const {
+		return Hmax < Hmin;
+	}
+	// the per-channel tests, for 8-bit channel values
+	bool containsH(int h) const {
+		if (isHueWrapped())
+			return h >= Hmin || h <= Hmax;
+		else
+			return h >= Hmin && h <= Hmax;
+	}
+	bool containsS(int s) const {
+		return s >= Smin && s <= Smax;
+	}
+	bool containsV(int v) const {
+		return v >= Vmin && v <= Vmax;
+	}
+	bool contains(int h, int s, int v) const {
+		return containsH(h) && containsS(s) && containsV(v);
+	}
+};
+
+// input file type must be HSV 8-bit
+// output file type must be same size, binary 8-bit
+void cvFilterHSV(cv::Mat &dstBin, cv::Mat &srcHSV, const cColor &color);
+
+// the original cv::inRange implementation of cvFilterHSV(), kept as reference
+void cvFilterHSVInRange(cv::Mat &dstBin, cv::Mat &srcHSV, const cColor &color);
+
+// threshold one row of HSV pixels in a single fused pass (AVX2, SSE2 or scalar, chosen at runtime)
+void filterHSVRow(uchar *dst, const uchar *src, int width, const cHSVLimits &limits);
+
+// BGR -> binary mask classifier using a precompiled lookup table.
+// The color range is compiled into one bit for each of the 256^3 BGR colors, so filtering
+// is a single pass over the BGR image without any HSV conversion. Each table allocates 8 MB
+// when first compiled: the 2 MB final table and one 2 MB table per component for incremental updates.
+// Compiling reads the HSV value of every BGR color from a 48 MB cube, which is shared by
+// all tables, built on first use and kept until the process exits.
+// The cube is computed with cvtColor(COLOR_BGR2HSV) of the linked OpenCV, so the result
+// is bit-exact with cvtColor(COLOR_BGR2HSV) + cvFilterHSV() of that same OpenCV.
+class cHSVLookupTable {
+public:
+	//! Constructor.
+	cHSVLookupTable();
+	// compile the table for a color; only the changed H/S/V components are rebuilt
+	// (the first call allocates the tables)
+	void update(const cColor &color);
+	// the table must have been compiled by update()
+	// input file type must be BGR 8-bit
+	// output file type must be same size, binary 8-bit
+	void filter(cv::Mat &dstBin, const cv::Mat &srcBGR) const;
+	// is a single BGR color in range? (compiled tables only)
+	bool contains(uchar b, uchar g, uchar r) const {
+		unsigned int i = ((unsigned int)b << 16) | ((unsigned int)g << 8) | r;
+		return (bits[i >> 3] >> (i & 7)) & 1;
+	}
+private:
+	void buildPlane(std::vector<uchar> &plane, const uchar *cube, const bool *accept);
+	std::vector<uchar> bits;   // final table: bitsH & bitsS & bitsV
+	std::vector<uchar> bitsH;  // per-component tables, kept for incremental updates
+	std::vector<uchar> bitsS;
+	std::vector<uchar> bitsV;
+	cHSVLimits limits;         // limits the tables were compiled for
+	bool bCompiled;
+};
+
+#endif
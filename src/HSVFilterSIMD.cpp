@@ -0,0 +1,179 @@
+// Fused single pass HSV range threshold kernels (AVX2, SSE2 and scalar).
+// All three hue/saturation/value intervals, including the circular hue interval,
+// are tested in one pass over the interleaved HSV bytes: each byte is compared with
+// the bounds of its channel, and a pixel is in range if all its three bytes are.
+
+#include <cstring>	// Used for "memcpy", "memset"
+#include <cstdint>
+
+#include "HSVFilter.h"
+#include "CpuFeatures.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// scalar version, also used for the last pixels of a row
+static void filterRowScalar(uchar *dst, const uchar *src, int width, const cHSVLimits &l) {
+	for (int x = 0; x < width; x++, src += 3) {
+		dst[x] = l.contains(src[0], src[1], src[2]) ? 255 : 0;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+// lookup tables to turn byte comparison bitmasks into pixel masks
+class cMaskTables {
+public:
+	uchar compact[4096];	// 12 byte bits (4 pixels) -> 4 pixel bits, set if all 3 byte bits are set
+	uint64_t expand[256];	// 8 pixel bits -> 8 mask bytes
+	cMaskTables() {
+		for (int v = 0; v < 4096; v++) {
+			compact[v] = 0;
+			for (int k = 0; k < 4; k++) {
+				if (((v >> (3*k)) & 7) == 7) compact[v] |= (uchar)(1 << k);
+			}
+		}
+		for (int v = 0; v < 256; v++) {
+			expand[v] = 0;
+			for (int k = 0; k < 8; k++) {
+				if (v & (1 << k)) expand[v] |= (uint64_t)0xFF << (8*k);
+			}
+		}
+	}
+};
+
+static const cMaskTables masktables;
+
+// byte bounds of the three channels, repeated with the HSV pattern
+class cRangePattern {
+public:
+	uchar lo[96];
+	uchar hi[96];
+	uchar wrap[96];		// 0xFF on hue bytes if the hue interval wraps around
+	bool bEmpty;		// nothing can be in range
+	bool bValid;		// limits can be represented with bytes
+	cRangePattern(const cHSVLimits &l) {
+		int lo3[3] = { l.Hmin, l.Smin, l.Vmin };
+		int hi3[3] = { l.Hmax, l.Smax, l.Vmax };
+		bool bWrap = l.isHueWrapped();
+		// hue limits are always 0-179 for valid colors, otherwise use the scalar code
+		bValid = l.Hmin >= 0 && l.Hmin <= 255 && l.Hmax >= 0 && l.Hmax <= 255;
+		// empty saturation or value ranges, like cv::inRange handles them
+		bEmpty = false;
+		for (int c = 1; c < 3; c++) {
+			if (lo3[c] > hi3[c] || lo3[c] > 255 || hi3[c] < 0) bEmpty = true;
+			if (lo3[c] < 0) lo3[c] = 0;
+			if (hi3[c] > 255) hi3[c] = 255;
+		}
+		for (int j = 0; j < 96; j++) {
+			int c = j % 3;
+			lo[j] = (uchar)lo3[c];
+			hi[j] = (uchar)hi3[c];
+			wrap[j] = (c == 0 && bWrap) ? 0xFF : 0;
+		}
+	}
+};
+
+// write 8 mask bytes for 8 pixel bits
+static inline void storeMask8(uchar *dst, unsigned int bits) {
+	uint64_t m = masktables.expand[bits & 0xFF];
+	memcpy(dst, &m, 8);
+}
+
+static void filterRowSSE2(uchar *dst, const uchar *src, int width, const cHSVLimits &l, const cRangePattern &p) {
+	__m128i vlo[3], vhi[3], vwrap[3];
+	int x = 0;
+	// bytes at offset 16*k start with channel k*16 % 3
+	for (int k = 0; k < 3; k++) {
+		vlo[k] = _mm_loadu_si128((const __m128i*)(p.lo + 16*k));
+		vhi[k] = _mm_loadu_si128((const __m128i*)(p.hi + 16*k));
+		vwrap[k] = _mm_loadu_si128((const __m128i*)(p.wrap + 16*k));
+	}
+	// 16 pixels = 48 bytes at a time
+	for (; x + 16 <= width; x += 16) {
+		const uchar *s = src + x*3;
+		uint64_t m = 0;
+		for (int k = 0; k < 3; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(s + 16*k));
+			__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, vlo[k]), v);
+			__m128i le = _mm_cmpeq_epi8(_mm_min_epu8(v, vhi[k]), v);
+			// inside [lo,hi], or on either side of it for the wrapped hue
+			__m128i ok = _mm_or_si128(_mm_and_si128(ge, le), _mm_and_si128(vwrap[k], _mm_or_si128(ge, le)));
+			m |= (uint64_t)(unsigned int)_mm_movemask_epi8(ok) << (16*k);
+		}
+		unsigned int bits =
+			masktables.compact[m & 0xFFF] |
+			(masktables.compact[(m >> 12) & 0xFFF] << 4) |
+			(masktables.compact[(m >> 24) & 0xFFF] << 8) |
+			(masktables.compact[(m >> 36) & 0xFFF] << 12);
+		storeMask8(dst + x, bits);
+		storeMask8(dst + x + 8, bits >> 8);
+	}
+	filterRowScalar(dst + x, src + x*3, width - x, l);
+}
+
+TARGET_AVX2
+static void filterRowAVX2(uchar *dst, const uchar *src, int width, const cHSVLimits &l, const cRangePattern &p) {
+	__m256i vlo[3], vhi[3], vwrap[3];
+	int x = 0;
+	// bytes at offset 32*k start with channel k*32 % 3
+	for (int k = 0; k < 3; k++) {
+		vlo[k] = _mm256_loadu_si256((const __m256i*)(p.lo + 32*k));
+		vhi[k] = _mm256_loadu_si256((const __m256i*)(p.hi + 32*k));
+		vwrap[k] = _mm256_loadu_si256((const __m256i*)(p.wrap + 32*k));
+	}
+	// 32 pixels = 96 bytes at a time
+	for (; x + 32 <= width; x += 32) {
+		const uchar *s = src + x*3;
+		uint32_t m[3];
+		for (int k = 0; k < 3; k++) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(s + 32*k));
+			__m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, vlo[k]), v);
+			__m256i le = _mm256_cmpeq_epi8(_mm256_min_epu8(v, vhi[k]), v);
+			// inside [lo,hi], or on either side of it for the wrapped hue
+			__m256i ok = _mm256_or_si256(_mm256_and_si256(ge, le), _mm256_and_si256(vwrap[k], _mm256_or_si256(ge, le)));
+			m[k] = (uint32_t)_mm256_movemask_epi8(ok);
+		}
+		// 96 byte bits -> 32 pixel bits, 12 bits at a time
+		uint64_t m01 = m[0] | ((uint64_t)m[1] << 32);
+		uint32_t bits =
+			masktables.compact[m01 & 0xFFF] |
+			(masktables.compact[(m01 >> 12) & 0xFFF] << 4) |
+			(masktables.compact[(m01 >> 24) & 0xFFF] << 8) |
+			(masktables.compact[(m01 >> 36) & 0xFFF] << 12) |
+			(masktables.compact[(m01 >> 48) & 0xFFF] << 16) |
+			((uint32_t)masktables.compact[(m01 >> 60) | ((m[2] & 0xFF) << 4)] << 20) |
+			((uint32_t)masktables.compact[(m[2] >> 8) & 0xFFF] << 24) |
+			((uint32_t)masktables.compact[(m[2] >> 20) & 0xFFF] << 28);
+		storeMask8(dst + x, bits);
+		storeMask8(dst + x + 8, bits >> 8);
+		storeMask8(dst + x + 16, bits >> 16);
+		storeMask8(dst + x + 24, bits >> 24);
+	}
+	filterRowScalar(dst + x, src + x*3, width - x, l);
+}
+
+#endif
+
+void filterHSVRow(uchar *dst, const uchar *src, int width, const cHSVLimits &limits) {
+#ifdef HAVE_X86_SIMD
+	int level = getSIMDLevel();
+	if (level >= SIMD_SSE2) {
+		cRangePattern p(limits);
+		if (p.bEmpty) {
+			memset(dst, 0, width);
+			return;
+		}
+		if (p.bValid) {
+			if (level >= SIMD_AVX2) {
+				filterRowAVX2(dst, src, width, limits, p);
+			} else {
+				filterRowSSE2(dst, src, width, limits, p);
+			}
+			return;
+		}
+	}
+#endif
+	filterRowScalar(dst, src, width, limits);
+}
@@ -0,0 +1,120 @@
+// 3D histogram of an HSV image for counting selected pixels without filtering.
+
+#include <algorithm>
+#include <cmath>
+
+#include "HSVHistogram.h"
+
+const int HIST_BINS = HIST_H_BINS * HIST_SV_BINS * HIST_SV_BINS;
+const int HIST_MIN_ROWS = 64; // rows of a part of the image counted on one thread, at least
+
+// index of a corner in the summed-volume table
+static inline int corner(int h, int s, int v) {
+	return (h * (HIST_SV_BINS + 1) + s) * (HIST_SV_BINS + 1) + v;
+}
+
+cHSVHistogram::cHSVHistogram()
+	:table((HIST_H_BINS + 1) * (HIST_SV_BINS + 1) * (HIST_SV_BINS + 1), 0), total(0)
+{}
+
+void cHSVHistogram::build(const cv::Mat &srcHSV, cThreadPool &pool) {
+	CV_Assert(srcHSV.type() == CV_8UC3);
+	int rows = srcHSV.rows, cols = srcHSV.cols;
+	int n = std::max(1, std::min(pool.size(), rows / HIST_MIN_ROWS));
+	if ((int)partial.size() < n) partial.resize(n);
+
+	// count each part of the image into its own histogram
+	pool.parallelFor(n, [&](int i) {
+		std::vector<int> &hist = partial[i];
+		hist.assign(HIST_BINS, 0);
+		for (int y = rows * i / n; y < rows * (i + 1) / n; y++) {
+			const uchar *p = srcHSV.ptr<uchar>(y);
+			for (int x = 0; x < cols; x++, p += 3) {
+				int h = std::min((int)p[0], HIST_H_BINS - 1);
+				hist[(h * HIST_SV_BINS + (p[1] >> HIST_SV_SHIFT)) * HIST_SV_BINS + (p[2] >> HIST_SV_SHIFT)]++;
+			}
+		}
+	});
+
+	// add them up and sum over saturation and value, one hue on each thread
+	pool.parallelFor(HIST_H_BINS, [&](int h) {
+		for (int s = 0; s < HIST_SV_BINS; s++) {
+			int *t = &table[corner(h + 1, s + 1, 1)];
+			const int *above = &table[corner(h + 1, s, 1)];
+			int rowsum = 0;
+			for (int v = 0; v < HIST_SV_BINS; v++) {
+				int bin = (h * HIST_SV_BINS + s) * HIST_SV_BINS + v;
+				for (int i = 0; i < n; i++) rowsum += partial[i][bin];
+				t[v] = above[v] + rowsum;
+			}
+		}
+	});
+	// sum over hue
+	for (int h = 1; h <= HIST_H_BINS; h++) {
+		int *t = &table[corner(h, 0, 0)];
+		const int *prev = &table[corner(h - 1, 0, 0)];
+		for (int i = 0; i < (HIST_SV_BINS + 1) * (HIST_SV_BINS + 1); i++) t[i] += prev[i];
+	}
+	total = rows * cols;
+}
+
+// number of pixels with hue < h, saturation bin < s and value bin < v, where
+// fractional s and v take the part of a bin proportional to its width
+double cHSVHistogram::sum(int h, double s, double v) const {
+	int s0 = (int)s, v0 = (int)v;
+	if (s0 >= HIST_SV_BINS) s0 = HIST_SV_BINS - 1;
+	if (v0 >= HIST_SV_BINS) v0 = HIST_SV_BINS - 1;
+	double fs = s - s0, fv = v - v0;
+	const int *t = &table[corner(h, s0, v0)];
+	const int next = HIST_SV_BINS + 1;
+	return (1 - fs) * ((1 - fv) * t[0] + fv * t[1]) + fs * ((1 - fv) * t[next] + fv * t[next + 1]);
+}
+
+double cHSVHistogram::countBox(int h0, int h1, int s0, int s1, int v0, int v1) const {
+	h0 = std::max(h0, 0); h1 = std::min(h1, HIST_H_BINS - 1);
+	s0 = std::max(s0, 0); s1 = std::min(s1, 255);
+	v0 = std::max(v0, 0); v1 = std::min(v1, 255);
+	if (h0 > h1 || s0 > s1 || v0 > v1) return 0;
+	// channel values to bin coordinates, the upper limits are inclusive
+	const double scale = 1.0 / (1 << HIST_SV_SHIFT);
+	double sa = s0 * scale, sb = (s1 + 1) * scale;
+	double va = v0 * scale, vb = (v1 + 1) * scale;
+	int ha = h0, hb = h1 + 1;
+	return sum(hb, sb, vb) - sum(hb, sb, va) - sum(hb, sa, vb) + sum(hb, sa, va)
+		- sum(ha, sb, vb) + sum(ha, sb, va) + sum(ha, sa, vb) - sum(ha, sa, va);
+}
+
+double cHSVHistogram::count(const cColor &color) const {
+	cHSVLimits l(color);
+	if (l.isHueWrapped()) {
+		return countBox(l.Hmin, HIST_H_BINS - 1, l.Smin, l.Smax, l.Vmin, l.Vmax)
+			+ countBox(0, l.Hmax, l.Smin, l.Smax, l.Vmin, l.Vmax);
+	}
+	return countBox(l.Hmin, l.Hmax, l.Smin, l.Smax, l.Vmin, l.Vmax);
+}
+
+void cHSVHistogram::getMarginals(const cColor &color, std::vector<double> &hues,
+	std::vector<double> &sats, std::vector<double> &vals) const
+{
+	cHSVLimits l(color);
+	const int step = 1 << HIST_SV_SHIFT;
+	hues.resize(HIST_H_BINS);
+	for (int h = 0; h < HIST_H_BINS; h++) {
+		hues[h] = countBox(h, h, l.Smin, l.Smax, l.Vmin, l.Vmax);
+	}
+	// the hue range as one or two boxes
+	int hranges[2][2] = { { l.Hmin, l.Hmax }, { 1, 0 } };
+	if (l.isHueWrapped()) {
+		hranges[0][1] = HIST_H_BINS - 1;
+		hranges[1][0] = 0;
+		hranges[1][1] = l.Hmax;
+	}
+	sats.assign(HIST_SV_BINS, 0);
+	vals.assign(HIST_SV_BINS, 0);
+	for (int r = 0; r < 2; r++) {
+		for (int b = 0; b < HIST_SV_BINS; b++) {
+			sats[b] += countBox(hranges[r][0], hranges[r][1], b * step, b * step + step - 1, l.Vmin, l.Vmax);
+			vals[b] += countBox(hranges[r][0], hranges[r][1], l.Smin, l.Smax, b * step, b * step + step - 1);
+		}
+	}
+}
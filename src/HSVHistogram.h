@@ -0,0 +1,45 @@
+// 3D histogram of an HSV image for counting selected pixels without filtering.
+
+#ifndef HSVHISTOGRAM_H
+#define HSVHISTOGRAM_H
+
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "ThreadPool.h"
+
+const int HIST_H_BINS = 180;	// one bin for each hue
+const int HIST_SV_SHIFT = 2;	// saturation and value are quantized to 256 >> HIST_SV_SHIFT levels
+const int HIST_SV_BINS = 256 >> HIST_SV_SHIFT;
+
+// Quantized 3D histogram of an HSV image, kept as a summed-volume table, so the number of
+// pixels in any box of HSV values is found with a few lookups. Hue is counted exactly;
+// within a saturation or value bin, pixels are assumed to be spread evenly, so counts
+// are exact for ranges on bin boundaries and close otherwise.
+class cHSVHistogram {
+public:
+	//! Constructor.
+	cHSVHistogram();
+	// build the histogram of an HSV image, on all threads of the pool
+	void build(const cv::Mat &srcHSV, cThreadPool &pool);
+	// approximate number of pixels selected by a color, with the hue range wrapped as in cvFilterHSV()
+	double count(const cColor &color) const;
+	// approximate number of pixels with h0 <= H <= h1, s0 <= S <= s1 and v0 <= V <= v1
+	double countBox(int h0, int h1, int s0, int s1, int v0, int v1) const;
+	// Number of pixels of each hue (HIST_H_BINS), saturation and value bin (HIST_SV_BINS)
+	// that are inside the ranges of the color in the other two channels.
+	void getMarginals(const cColor &color, std::vector<double> &hues,
+		std::vector<double> &sats, std::vector<double> &vals) const;
+	// number of pixels in the image
+	int getTotal() const { return total; }
+private:
+	double sum(int h, double s, double v) const;
+	std::vector<int> table;		// counts of all bins below and before each corner
+	std::vector<std::vector<int> > partial;	// histograms of parts of the image, for build()
+	int total;
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Counting of heap allocations (operator new) in debug builds.
+
+#include <cstdlib>	// Used for "malloc", "free"
+#include <atomic>
+#include <new>
+
+#include "HeapCounter.h"
+
+#ifndef NDEBUG
+
+static std::atomic<long long> heapallocations(0);
+
+long long getHeapAllocationCount() {
+	return heapallocations;
+}
+
+// the replacements of all forms of operator new, deleting is only passed on
+void *operator new(size_t size) {
+	heapallocations++;
+	void *p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	heapallocations++;
+	return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	free(p);
+}
+
+#else
+
+long long getHeapAllocationCount() {
+	return -1;
+}
+
+#endif
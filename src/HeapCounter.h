@@ -0,0 +1,12 @@
+// Counting of heap allocations (operator new) in debug builds.
+
+#ifndef HEAPCOUNTER_H
+#define HEAPCOUNTER_H
+
+// Number of blocks allocated with operator new by the whole program so far, or -1 if not
+// counted. Only debug builds (NDEBUG not defined) count, by replacing operator new; this
+// is built into the programs, not into the colorWheelHSVcore library. Memory that OpenCV
+// allocates with its own allocator (cv::Mat buffers) is counted by getAllocationCount().
+long long getHeapAllocationCount();
+
+#endif
@@ -0,0 +1,127 @@
+// Compositing of filter results onto the input image for display.
+// The mask is applied to the interleaved BGR bytes in a single pass (AVX2, SSSE3 or scalar):
+// each mask byte is repeated for the three bytes of its pixel, then ORed into the
+// highlighted channels and cleared from the others.
+
+#include "Highlight.h"
+#include "CpuFeatures.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// bytes to OR the mask into and to clear with the mask, repeated with the BGR pattern
+class cPaintPattern {
+public:
+    uchar set[96];
+    uchar clear[96];
+    cPaintPattern(int iChannel) {
+        for (int j = 0; j < 96; j++) {
+            int c = j % 3;
+            // white: all channels are set, nothing is cleared
+            set[j] = (iChannel > 2 || c == iChannel) ? 0xFF : 0;
+            clear[j] = (uchar)~set[j];
+        }
+    }
+};
+
+// scalar version, also used for the last pixels of a row
+static void highlightRowScalar(uchar *dst, const uchar *src, const uchar *bin, int width, const cPaintPattern &p) {
+    for (int x = 0; x < width; x++, src += 3, dst += 3) {
+        uchar m = bin[x];
+        dst[0] = (uchar)((src[0] | (m & p.set[0])) & ~(m & p.clear[0]));
+        dst[1] = (uchar)((src[1] | (m & p.set[1])) & ~(m & p.clear[1]));
+        dst[2] = (uchar)((src[2] | (m & p.set[2])) & ~(m & p.clear[2]));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// shuffles that repeat each mask byte three times
+class cExpandTables {
+public:
+    uchar ssse3[48];	// byte j of 16 pixels <- mask byte j/3
+    uchar avx2[96];		// byte j of 32 pixels <- mask byte j/3, from 16 mask bytes loaded at 8*(j/32)
+    cExpandTables() {
+        for (int j = 0; j < 48; j++) ssse3[j] = (uchar)(j / 3);
+        for (int j = 0; j < 96; j++) avx2[j] = (uchar)(j / 3 - 8*(j / 32));
+    }
+};
+
+static const cExpandTables expandtables;
+
+TARGET_SSSE3
+static void highlightRowSSSE3(uchar *dst, const uchar *src, const uchar *bin, int width, const cPaintPattern &p) {
+    __m128i vexpand[3], vset[3], vclear[3];
+    int x = 0;
+    // bytes at offset 16*k start with channel k*16 % 3
+    for (int k = 0; k < 3; k++) {
+        vexpand[k] = _mm_loadu_si128((const __m128i*)(expandtables.ssse3 + 16*k));
+        vset[k] = _mm_loadu_si128((const __m128i*)(p.set + 16*k));
+        vclear[k] = _mm_loadu_si128((const __m128i*)(p.clear + 16*k));
+    }
+    // 16 pixels = 48 bytes at a time
+    for (; x + 16 <= width; x += 16) {
+        __m128i m = _mm_loadu_si128((const __m128i*)(bin + x));
+        for (int k = 0; k < 3; k++) {
+            __m128i m3 = _mm_shuffle_epi8(m, vexpand[k]);
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x*3 + 16*k));
+            v = _mm_andnot_si128(_mm_and_si128(m3, vclear[k]), _mm_or_si128(v, _mm_and_si128(m3, vset[k])));
+            _mm_storeu_si128((__m128i*)(dst + x*3 + 16*k), v);
+        }
+    }
+    highlightRowScalar(dst + x*3, src + x*3, bin + x, width - x, p);
+}
+
+TARGET_AVX2
+static void highlightRowAVX2(uchar *dst, const uchar *src, const uchar *bin, int width, const cPaintPattern &p) {
+    __m256i vexpand[3], vset[3], vclear[3];
+    int x = 0;
+    // bytes at offset 32*k start with channel k*32 % 3
+    for (int k = 0; k < 3; k++) {
+        vexpand[k] = _mm256_loadu_si256((const __m256i*)(expandtables.avx2 + 32*k));
+        vset[k] = _mm256_loadu_si256((const __m256i*)(p.set + 32*k));
+        vclear[k] = _mm256_loadu_si256((const __m256i*)(p.clear + 32*k));
+    }
+    // 32 pixels = 96 bytes at a time
+    for (; x + 32 <= width; x += 32) {
+        for (int k = 0; k < 3; k++) {
+            // the shuffle stays within 128 bit lanes, so both lanes get the same 16 mask bytes
+            __m256i m = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(bin + x + 8*k)));
+            __m256i m3 = _mm256_shuffle_epi8(m, vexpand[k]);
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + x*3 + 32*k));
+            v = _mm256_andnot_si256(_mm256_and_si256(m3, vclear[k]), _mm256_or_si256(v, _mm256_and_si256(m3, vset[k])));
+            _mm256_storeu_si256((__m256i*)(dst + x*3 + 32*k), v);
+        }
+    }
+    highlightRowScalar(dst + x*3, src + x*3, bin + x, width - x, p);
+}
+
+#endif
+
+void HighlightMask(const cv::Mat &srcBGR, const cv::Mat &srcBin, cv::Mat &dstBGR, int iChannel) {
+    CV_Assert(srcBGR.type() == CV_8UC3 && srcBin.type() == CV_8UC1 && srcBin.size() == srcBGR.size());
+    // white, or full blue, green or red with the other two channels cleared;
+    // done in place if dstBGR is srcBGR, each row is read before it is written
+    dstBGR.create(srcBGR.size(), CV_8UC3);
+    cPaintPattern p(iChannel);
+#ifdef HAVE_X86_SIMD
+    int level = getSIMDLevel();
+#endif
+    for (int y = 0; y < srcBGR.rows; y++) {
+        const uchar *src = srcBGR.ptr<uchar>(y);
+        const uchar *bin = srcBin.ptr<uchar>(y);
+        uchar *dst = dstBGR.ptr<uchar>(y);
+#ifdef HAVE_X86_SIMD
+        if (level >= SIMD_AVX2) {
+            highlightRowAVX2(dst, src, bin, srcBGR.cols, p);
+            continue;
+        }
+        if (level >= SIMD_SSSE3) {
+            highlightRowSSSE3(dst, src, bin, srcBGR.cols, p);
+            continue;
+        }
+#endif
+        highlightRowScalar(dst, src, bin, srcBGR.cols, p);
+    }
+}
@@ -0,0 +1,14 @@
+// Compositing of filter results onto the input image for display.
+
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+// draw the pixels of a binary filter image (0 or 255) onto a BGR image:
+// iChannel 0 = blue, 1 = green, 2 = red, 3 = white. The mask is ORed into the
+// highlighted channels and cleared from the others in one pass; dstBGR may be srcBGR.
+void HighlightMask(const cv::Mat &srcBGR, const cv::Mat &srcBin, cv::Mat &dstBGR, int iChannel);
+
+#endif
@@ -0,0 +1,111 @@
+// Single pass classification of an image against a whole palette of colors.
+
+#include "PaletteFilter.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// index of lowest set bit (m must not be zero)
+static inline int lowestBit(uint64_t m) {
+#ifdef _MSC_VER
+	unsigned long i;
+#ifdef _WIN64
+	_BitScanForward64(&i, m);
+#else
+	if ((uint32_t)m) _BitScanForward(&i, (uint32_t)m);
+	else { _BitScanForward(&i, (uint32_t)(m >> 32)); i += 32; }
+#endif
+	return (int)i;
+#else
+	return __builtin_ctzll(m);
+#endif
+}
+
+cPaletteFilter::cPaletteFilter() {}
+
+void cPaletteFilter::update(const std::vector<cColor> &palette) {
+	// the GUI refuses to save more colors; anything beyond is ignored here
+	int n = (int)palette.size();
+	if (n > MAX_PALETTE_SIZE) n = MAX_PALETTE_SIZE;
+
+	// structure-of-arrays limits
+	Hmin.resize(n); Hmax.resize(n);
+	Smin.resize(n); Smax.resize(n);
+	Vmin.resize(n); Vmax.resize(n);
+	for (int i = 0; i < n; i++) {
+		cHSVLimits l(palette[i]);
+		Hmin[i] = l.Hmin; Hmax[i] = l.Hmax;
+		Smin[i] = l.Smin; Smax[i] = l.Smax;
+		Vmin[i] = l.Vmin; Vmax[i] = l.Vmax;
+	}
+
+	// membership bitmasks, 64 colors per group (at least one, even for an empty palette)
+	int groups = n / 64 + 1;
+	maskH.assign(groups * 256, 0);
+	maskS.assign(groups * 256, 0);
+	maskV.assign(groups * 256, 0);
+	for (int i = 0; i < n; i++) {
+		uint64_t bit = (uint64_t)1 << (i & 63);
+		uint64_t *mH = &maskH[(i >> 6) * 256];
+		uint64_t *mS = &maskS[(i >> 6) * 256];
+		uint64_t *mV = &maskV[(i >> 6) * 256];
+		bool bWrapped = Hmax[i] < Hmin[i];
+		for (int x = 0; x < 256; x++) {
+			if (bWrapped ? (x >= Hmin[i] || x <= Hmax[i]) : (x >= Hmin[i] && x <= Hmax[i])) mH[x] |= bit;
+			if (x >= Smin[i] && x <= Smax[i]) mS[x] |= bit;
+			if (x >= Vmin[i] && x <= Vmax[i]) mV[x] |= bit;
+		}
+	}
+}
+
+// add a row of labels to four interleaved histograms, so that runs of equal labels
+// do not wait on each other's increment
+static void countLabels(const uchar *d, int cols, int (*c)[256]) {
+	int x = 0;
+	for (; x + 4 <= cols; x += 4) {
+		c[0][d[x]]++;
+		c[1][d[x + 1]]++;
+		c[2][d[x + 2]]++;
+		c[3][d[x + 3]]++;
+	}
+	for (; x < cols; x++) c[0][d[x]]++;
+}
+
+void cPaletteFilter::filter(cv::Mat &dstLabels, const cv::Mat &srcHSV, std::vector<int> &counts) const {
+	CV_Assert(srcHSV.type() == CV_8UC3);
+	int n = size();
+	int groups = (n + 63) / 64;
+	dstLabels.create(srcHSV.size(), CV_8UC1);
+	int c[4][256] = {};
+	for (int y = 0; y < srcHSV.rows; y++) {
+		const uchar *s = srcHSV.ptr<uchar>(y);
+		uchar *d = dstLabels.ptr<uchar>(y);
+		if (n < 64) {
+			// single group: a stop bit above the palette turns "no color" into
+			// index n, so the label is found without a data dependent branch
+			const uint64_t *mH = &maskH[0], *mS = &maskS[0], *mV = &maskV[0];
+			uint64_t stop = (uint64_t)1 << n;
+			for (int x = 0; x < srcHSV.cols; x++, s += 3) {
+				int i = lowestBit((mH[s[0]] & mS[s[1]] & mV[s[2]]) | stop);
+				d[x] = (uchar)(i == n ? 0 : i + 1);
+			}
+		}
+		else {
+			for (int x = 0; x < srcHSV.cols; x++, s += 3) {
+				int label = 0;
+				for (int g = 0; g < groups; g++) {
+					uint64_t m = maskH[g*256 + s[0]] & maskS[g*256 + s[1]] & maskV[g*256 + s[2]];
+					if (m) {
+						label = g*64 + lowestBit(m) + 1;
+						break;
+					}
+				}
+				d[x] = (uchar)label;
+			}
+		}
+		countLabels(d, srcHSV.cols, c);
+	}
+	counts.resize(n + 1);
+	for (int i = 0; i <= n; i++) counts[i] = c[0][i] + c[1][i] + c[2][i] + c[3][i];
+}
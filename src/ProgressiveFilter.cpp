@@ -0,0 +1,85 @@
+// Filtering for the GUI: a quick preview at window size, the full frame in the background.
+
+#include "ProgressiveFilter.h"
+#include "StageTimer.h"
+
+cProgressiveFilter::cProgressiveFilter(cThreadPool &pool, cHSVDetector &detector)
+	:detector(detector), previewdetector(pool), converter(pool)
+	,levelgeneration(0), levelwidth(0), bRunning(false), bCancel(false), bDone(false), bComplete(false)
+{}
+
+cProgressiveFilter::~cProgressiveFilter() {
+	cancel();
+}
+
+double cProgressiveFilter::preview(const cv::Mat &srcBGR, const cv::Mat &srcHSV, unsigned int generation, const cColor &color,
+	int width, int iHighlightChannel, cv::Mat &dstHighlight)
+{
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	// halve the frame while it stays at least as wide as the window
+	if (levelgeneration != generation || levelwidth != width || level.empty()) {
+		STAGE_TIMER("preview.pyramid");
+		// the levels keep their buffers from frame to frame
+		level = srcBGR;
+		for (int i = 0; level.cols / 2 >= width; i++) {
+			if ((int)pyramid.size() <= i) pyramid.resize(i + 1);
+			cv::pyrDown(level, pyramid[i]);
+			level = pyramid[i];
+		}
+		if (level.data == srcBGR.data && !srcHSV.empty()) {
+			levelHSV = srcHSV; // the frame was not halved, its HSV version is there already
+		} else {
+			converter.convert(level, hsvbuffer);
+			levelHSV = hsvbuffer;
+		}
+		levelgeneration = generation;
+		levelwidth = width;
+	}
+	// the HSV level is filtered even if the detector uses the lookup table, the results are the same
+	cDetectorOptions options;
+	options.iHighlightChannel = iHighlightChannel;
+	options.iBlobMode = BLOBS_NONE;
+	previewdetector.setOptions(options);
+	previewdetector.setColor(color);
+	previewdetector.detect(0, level, levelHSV, previewresult);
+	dstHighlight = previewresult.highlight;
+	return (double)srcBGR.cols / level.cols;
+}
+
+void cProgressiveFilter::start(int frame, const cv::Mat &srcBGR, const cv::Mat &srcHSV) {
+	cancel();
+	bCancel = false;
+	bDone = false;
+	bComplete = false;
+	error = std::exception_ptr();
+	bRunning = true;
+	worker = std::thread(&cProgressiveFilter::run, this, frame, srcBGR, srcHSV);
+}
+
+void cProgressiveFilter::run(int frame, cv::Mat srcBGR, cv::Mat srcHSV) {
+	try {
+		STAGE_TIMER("refine");
+		bComplete = detector.detect(frame, srcBGR, srcHSV, result, &bCancel);
+	} catch (...) {
+		error = std::current_exception();
+	}
+	bDone = true;
+}
+
+void cProgressiveFilter::cancel() {
+	if (!bRunning) return;
+	bCancel = true;
+	worker.join();
+	bRunning = false;
+}
+
+bool cProgressiveFilter::finish(cDetection &result) {
+	if (!bRunning || !bDone) return false;
+	worker.join();
+	bRunning = false;
+	if (error) std::rethrow_exception(error);
+	if (!bComplete) return false;
+	// swap buffers with the caller, the next run writes into the ones it had
+	result.swap(this->result);
+	return true;
+}
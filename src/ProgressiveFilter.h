@@ -0,0 +1,72 @@
+// Filtering for the GUI: a quick preview at window size, the full frame in the background.
+
+#ifndef PROGRESSIVEFILTER_H
+#define PROGRESSIVEFILTER_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "ThreadPool.h"
+#include "Detector.h"
+
+const int REFINE_DELAY_MS = 150; // time without events before the full frame is filtered
+
+// Filters a frame twice for display. The preview filters the smallest level of an
+// image pyramid that is still at least as wide as the window, so its cost does not
+// depend on the input resolution; the level is built once per frame. The full
+// resolution pass (mask, highlight, blobs and tracks) runs on a background thread with
+// a detector, and can be canceled between bands when a new event arrives.
+class cProgressiveFilter {
+public:
+	//! Constructor.
+	cProgressiveFilter(cThreadPool &pool, cHSVDetector &detector);
+	//! Destructor.
+	~cProgressiveFilter();
+	// Filter the pyramid level of a BGR frame for a window width and highlight the result
+	// with a channel (see HighlightMask()). The level is kept while generation does not
+	// change. srcHSV is the HSV frame if the caller has it (or empty), it is used when the
+	// frame is not halved. Returns the number of frame pixels for one pixel of dstHighlight.
+	double preview(const cv::Mat &srcBGR, const cv::Mat &srcHSV, unsigned int generation, const cColor &color,
+		int width, int iHighlightChannel, cv::Mat &dstHighlight);
+	// Start detecting a frame at full resolution in the background with the settings of
+	// the detector (see cHSVDetector::detect()). The frame and srcHSV (the HSV frame, or
+	// empty to convert it band by band) must not be changed until the work is finished or canceled.
+	void start(int frame, const cv::Mat &srcBGR, const cv::Mat &srcHSV);
+	// stop the background work and wait for it, its results are dropped
+	void cancel();
+	// Get the results of the background work if it is finished, false if it is not.
+	// The buffers are swapped, the next run writes into the ones passed here, so the
+	// caller must not keep references to them.
+	bool finish(cDetection &result);
+	// has the background work been started and not finished or canceled yet?
+	bool isRunning() const {
+		return bRunning;
+	}
+private:
+	void run(int frame, cv::Mat srcBGR, cv::Mat srcHSV);
+	cHSVDetector &detector;			// full resolution
+	cHSVDetector previewdetector;	// pyramid level
+	std::vector<cv::Mat> pyramid;	// halved frames
+	cv::Mat level;					// pyramid level of the last frame (the frame or one of pyramid)
+	cv::Mat levelHSV;				// HSV version of level (srcHSV of preview() or hsvbuffer)
+	cv::Mat hsvbuffer;				// HSV levels converted here
+	cTilePipeline converter;		// converts levels on all threads
+	unsigned int levelgeneration;	// frame generation level was built from (0 = never)
+	int levelwidth;					// window width level was built for
+	cDetection previewresult;		// results of the preview
+	bool bRunning;
+	std::thread worker;
+	std::atomic<bool> bCancel;		// stop the background work
+	std::atomic<bool> bDone;		// the background work is finished
+	bool bComplete;					// was it finished without being canceled?
+	std::exception_ptr error;		// exception thrown by the background work
+	cDetection result;				// results of the background work
+};
+
+#endif
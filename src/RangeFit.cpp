@@ -0,0 +1,115 @@
+// Fitting colors and color ranges to image regions.
+
+#include <algorithm>
+
+#include "RangeFit.h"
+
+void cIntegralImage::build(const cv::Mat &srcBGR) {
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	cv::integral(srcBGR, sum, CV_64F);
+}
+
+cv::Vec3d cIntegralImage::getMean(cv::Rect r) const {
+	r &= cv::Rect(0, 0, sum.cols - 1, sum.rows - 1);
+	if (r.area() <= 0) return cv::Vec3d(0, 0, 0);
+	const cv::Vec3d &a = sum.at<cv::Vec3d>(r.y, r.x);
+	const cv::Vec3d &b = sum.at<cv::Vec3d>(r.y, r.x + r.width);
+	const cv::Vec3d &c = sum.at<cv::Vec3d>(r.y + r.height, r.x);
+	const cv::Vec3d &d = sum.at<cv::Vec3d>(r.y + r.height, r.x + r.width);
+	double area = r.area();
+	return cv::Vec3d((d[0] - b[0] - c[0] + a[0]) / area,
+		(d[1] - b[1] - c[1] + a[1]) / area,
+		(d[2] - b[2] - c[2] + a[2]) / area);
+}
+
+cv::Vec3b cIntegralImage::getMeanHSV(int x, int y, int radius) const {
+	cv::Vec3d mean = getMean(cv::Rect(x - radius, y - radius, 2 * radius + 1, 2 * radius + 1));
+	cv::Mat pixel(1, 1, CV_8UC3);
+	pixel.at<cv::Vec3b>(0, 0) = cv::Vec3b(cv::saturate_cast<uchar>(mean[0]),
+		cv::saturate_cast<uchar>(mean[1]), cv::saturate_cast<uchar>(mean[2]));
+	cv::cvtColor(pixel, pixel, cv::COLOR_BGR2HSV);
+	return pixel.at<cv::Vec3b>(0, 0);
+}
+
+// Values lo <= hi of the bins from start on (wrapping around size) so that at most
+// k counts are below lo and above hi. Values are counted from start, not wrapped.
+static void getPercentileRange(const int *hist, int size, int start, int n, int k, int &lo, int &hi) {
+	int sum = 0;
+	lo = -1;
+	hi = size - 1;
+	for (int i = 0; i < size; i++) {
+		sum += hist[(start + i) % size];
+		if (lo < 0 && sum > k) lo = i;
+		if (sum >= n - k) {
+			hi = i;
+			break;
+		}
+	}
+	if (lo < 0 || lo > hi) lo = hi;
+}
+
+int FitColorRange(cColor &color, const cv::Mat &srcHSV, const cv::Mat &mask, double percentile) {
+	CV_Assert(srcHSV.type() == CV_8UC3);
+	CV_Assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == srcHSV.size()));
+	int hist[3][256] = {{0}};
+	int n = 0;
+
+	// histogram of each channel over the region
+	for (int y = 0; y < srcHSV.rows; y++) {
+		const uchar *p = srcHSV.ptr<uchar>(y);
+		const uchar *m = mask.empty() ? 0 : mask.ptr<uchar>(y);
+		for (int x = 0; x < srcHSV.cols; x++, p += 3) {
+			if (m && !m[x]) continue;
+			hist[0][std::min((int)p[0], 179)]++;
+			hist[1][p[1]]++;
+			hist[2][p[2]]++;
+			n++;
+		}
+	}
+	if (!n) return 0;
+	int k = (int)(n * percentile / 100);
+	int lo, hi;
+
+	// Hue: start after the largest gap of missing hues, or after the rarest hue if none is missing
+	int start = 0, gap = 0, rarest = 0;
+	for (int i = 0, run = 0; i < 2 * 180; i++) {
+		if (hist[0][i % 180]) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run > gap && run <= 180) {
+			gap = run;
+			start = (i + 1) % 180;
+		}
+	}
+	if (!gap) {
+		for (int i = 0; i < 180; i++) if (hist[0][i] < hist[0][rarest]) rarest = i;
+		start = (rarest + 1) % 180;
+	}
+	getPercentileRange(hist[0], 180, start, n, k, lo, hi);
+	color.rangeH = (hi - lo + 1) / 2;
+	color.H = (start + lo + color.rangeH) % 180;
+
+	// Saturation and Value
+	getPercentileRange(hist[1], 256, 0, n, k, lo, hi);
+	color.rangeS = (hi - lo + 1) / 2;
+	color.S = lo + color.rangeS;
+	getPercentileRange(hist[2], 256, 0, n, k, lo, hi);
+	color.rangeV = (hi - lo + 1) / 2;
+	color.V = lo + color.rangeV;
+
+	return n;
+}
+
+cv::Rect FloodFillRegion(const cv::Mat &srcBGR, cv::Point seed, int tolerance, cv::Mat &dstMask) {
+	cv::Mat mask = cv::Mat::zeros(srcBGR.rows + 2, srcBGR.cols + 2, CV_8UC1);
+	cv::Rect box;
+	cv::Scalar diff(tolerance, tolerance, tolerance);
+	cv::Mat image = srcBGR; // not changed, only the mask is filled
+	// compare with the seed, not with the neighbors, so the region cannot creep away on gradients
+	cv::floodFill(image, mask, seed, cv::Scalar(), &box, diff, diff,
+		8 | cv::FLOODFILL_FIXED_RANGE | cv::FLOODFILL_MASK_ONLY | (255 << 8));
+	dstMask = mask(cv::Rect(box.x + 1, box.y + 1, box.width, box.height));
+	return box;
+}
@@ -0,0 +1,42 @@
+// Fitting colors and color ranges to image regions.
+
+#ifndef RANGEFIT_H
+#define RANGEFIT_H
+
+#include <vector>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+
+const int DEFAULT_SAMPLE_RADIUS = 2;		// neighbors averaged around a clicked pixel (2 --> 5x5)
+const double DEFAULT_FIT_PERCENTILE = 2;	// percent of the pixels left out at both ends of each channel
+const int DEFAULT_FLOOD_TOLERANCE = 20;		// BGR difference from the clicked pixel that is still part of a region
+
+// Mean BGR color of any rectangle of an image in constant time, from its integral image.
+class cIntegralImage {
+public:
+	// compute the integral image of a BGR image
+	void build(const cv::Mat &srcBGR);
+	// mean color of the pixels of a rectangle, clipped to the image
+	cv::Vec3d getMean(cv::Rect r) const;
+	// HSV color of the mean of the (2*radius+1)^2 pixels around a point
+	cv::Vec3b getMeanHSV(int x, int y, int radius) const;
+	bool empty() const { return sum.empty(); }
+private:
+	cv::Mat sum;	// sums of all pixels above and left of each point, CV_64FC3
+};
+
+// The color range that selects the HSV pixels of a region, except for the given percent
+// of outliers at both ends of each channel. Hue is circular: the range is placed
+// opposite to the largest gap of hues not found in the region. mask selects the pixels
+// of the region (8-bit, same size as srcHSV), or all pixels if it is empty.
+// Returns the number of pixels of the region.
+int FitColorRange(cColor &color, const cv::Mat &srcHSV, const cv::Mat &mask, double percentile);
+
+// Pixels of the region connected to a seed point and differing from it by at most
+// tolerance in each BGR channel. dstMask gets the region inside the returned bounding box.
+cv::Rect FloodFillRegion(const cv::Mat &srcBGR, cv::Point seed, int tolerance, cv::Mat &dstMask);
+
+#endif
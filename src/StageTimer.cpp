@@ -0,0 +1,132 @@
+// Lightweight per-stage latency measurement with histograms.
+
+#include <cstdio>	// Used for file output
+#include <cstring>	// Used for "strcmp"
+#include <deque>
+#include <mutex>
+#include <iomanip>
+
+#include "StageTimer.h"
+
+static std::atomic<bool> bStageTimers(false);
+static std::mutex stagemutex;		// guards the list of stages
+static std::deque<cStageStats> stages;	// in order of first use
+
+// histogram bin of a latency: 4 bins for each power of 2
+static int getBin(uint64_t ns) {
+	if (ns < 8) return (int)ns;
+	int msb = 63;
+	while (!(ns >> msb)) msb--;
+	return msb * 4 + (int)((ns >> (msb - 2)) & 3);
+}
+
+// middle of the latencies of a bin
+static double getBinValue(int bin) {
+	if (bin < 8) return bin;
+	int msb = bin / 4;
+	double lower = (double)(4 + bin % 4) * ((uint64_t)1 << (msb - 2));
+	double width = (double)((uint64_t)1 << (msb - 2));
+	return lower + width / 2;
+}
+
+cStageStats::cStageStats(const char *name)
+	:name(name), count(0), total(0), maximum(0)
+{
+	for (int i = 0; i < STAGE_BINS; i++) bins[i] = 0;
+}
+
+void cStageStats::add(uint64_t ns) {
+	count.fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(ns, std::memory_order_relaxed);
+	bins[getBin(ns)].fetch_add(1, std::memory_order_relaxed);
+	uint64_t m = maximum.load(std::memory_order_relaxed);
+	while (ns > m && !maximum.compare_exchange_weak(m, ns, std::memory_order_relaxed));
+}
+
+double cStageStats::getPercentile(double p) const {
+	uint64_t n = 0;
+	for (int i = 0; i < STAGE_BINS; i++) n += bins[i].load(std::memory_order_relaxed);
+	if (!n) return 0;
+	uint64_t target = (uint64_t)(p * n + 0.5), sum = 0;
+	if (target < 1) target = 1;
+	for (int i = 0; i < STAGE_BINS; i++) {
+		sum += bins[i].load(std::memory_order_relaxed);
+		if (sum >= target) return getBinValue(i);
+	}
+	return (double)maximum.load(std::memory_order_relaxed);
+}
+
+void cStageStats::reset() {
+	count = 0;
+	total = 0;
+	maximum = 0;
+	for (int i = 0; i < STAGE_BINS; i++) bins[i] = 0;
+}
+
+bool isStageTimerEnabled() {
+	return bStageTimers.load(std::memory_order_relaxed);
+}
+
+void enableStageTimers(bool bEnable) {
+	bStageTimers = bEnable;
+}
+
+cStageStats *getStageStats(const char *name) {
+	std::lock_guard<std::mutex> lock(stagemutex);
+	for (size_t i = 0; i < stages.size(); i++) {
+		if (!strcmp(stages[i].name, name)) return &stages[i];
+	}
+	stages.emplace_back(name);
+	return &stages.back();
+}
+
+void printStageTimers(std::ostream &out) {
+	std::lock_guard<std::mutex> lock(stagemutex);
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::left << std::setw(20) << "stage" << std::right
+		<< std::setw(10) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+		<< std::setw(10) << "p95" << std::setw(10) << "p99" << std::setw(10) << "max" << "  (ms)" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (size_t i = 0; i < stages.size(); i++) {
+		const cStageStats &s = stages[i];
+		uint64_t n = s.count;
+		if (!n) continue;
+		out << std::left << std::setw(20) << s.name << std::right
+			<< std::setw(10) << n
+			<< std::setw(10) << s.total / (double)n / 1e6
+			<< std::setw(10) << s.getPercentile(0.50) / 1e6
+			<< std::setw(10) << s.getPercentile(0.95) / 1e6
+			<< std::setw(10) << s.getPercentile(0.99) / 1e6
+			<< std::setw(10) << s.maximum / 1e6 << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
+
+bool writeStageTimersJSON(const char *filename) {
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+	std::lock_guard<std::mutex> lock(stagemutex);
+	fprintf(f, "{\n  \"stages\": [\n");
+	bool bFirst = true;
+	for (size_t i = 0; i < stages.size(); i++) {
+		const cStageStats &s = stages[i];
+		uint64_t n = s.count;
+		if (!n) continue;
+		fprintf(f, "%s    {\"name\": \"%s\", \"count\": %llu, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}",
+			bFirst ? "" : ",\n", s.name, (unsigned long long)n, s.total / (double)n / 1e6,
+			s.getPercentile(0.50) / 1e6, s.getPercentile(0.95) / 1e6, s.getPercentile(0.99) / 1e6,
+			s.maximum / 1e6);
+		bFirst = false;
+	}
+	fprintf(f, "\n  ]\n}\n");
+	return fclose(f) == 0;
+}
+
+void resetStageTimers() {
+	std::lock_guard<std::mutex> lock(stagemutex);
+	for (size_t i = 0; i < stages.size(); i++) {
+		stages[i].reset();
+	}
+}
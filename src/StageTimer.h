@@ -0,0 +1,72 @@
+// Lightweight per-stage latency measurement with histograms.
+
+#ifndef STAGETIMER_H
+#define STAGETIMER_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+const int STAGE_BINS = 256;	// histogram bins, 4 for each power of 2 nanoseconds
+
+// latency statistics of a stage, can be updated from any thread
+class cStageStats {
+public:
+	const char *name;
+	std::atomic<uint64_t> count;	// number of measurements
+	std::atomic<uint64_t> total;	// sum of latencies in ns
+	std::atomic<uint64_t> maximum;	// largest latency in ns
+	std::atomic<uint32_t> bins[STAGE_BINS];	// latency histogram
+	//! Constructor.
+	explicit cStageStats(const char *name);
+	// add a measurement
+	void add(uint64_t ns);
+	// approximate latency in ns below which the given fraction of measurements are
+	double getPercentile(double p) const;
+	void reset();
+};
+
+// are the stage timers measuring? They cost almost nothing when not.
+bool isStageTimerEnabled();
+void enableStageTimers(bool bEnable);
+
+// statistics of a stage by name, created on first use; the pointer stays valid
+cStageStats *getStageStats(const char *name);
+
+// print a table of all stages
+void printStageTimers(std::ostream &out);
+// write all stages to a JSON file
+bool writeStageTimersJSON(const char *filename);
+// clear all measurements
+void resetStageTimers();
+
+// Measures the time from its construction to the end of its scope, if enabled.
+class cStageTimer {
+public:
+	//! Constructor.
+	explicit cStageTimer(cStageStats *stats)
+		:stats(isStageTimerEnabled() ? stats : 0)
+	{
+		if (this->stats) start = std::chrono::steady_clock::now();
+	}
+	//! Destructor.
+	~cStageTimer() {
+		if (stats) {
+			stats->add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+	}
+private:
+	cStageStats *stats;
+	std::chrono::steady_clock::time_point start;
+};
+
+// time the rest of the scope as the stage with the given name (a string literal)
+#define STAGE_TIMER_CONCAT2(a, b) a##b
+#define STAGE_TIMER_CONCAT(a, b) STAGE_TIMER_CONCAT2(a, b)
+#define STAGE_TIMER(name) \
+	static cStageStats *STAGE_TIMER_CONCAT(stagestats_, __LINE__) = getStageStats(name); \
+	cStageTimer STAGE_TIMER_CONCAT(stagetimer_, __LINE__)(STAGE_TIMER_CONCAT(stagestats_, __LINE__))
+
+#endif
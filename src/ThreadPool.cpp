@@ -0,0 +1,124 @@
+// Work-stealing thread pool for data parallel loops.
+
+#include "ThreadPool.h"
+
+cThreadPool::cThreadPool()
+	:queues(1), call(0), task(0), pending(0), generation(0), bStop(false)
+{}
+
+cThreadPool::~cThreadPool() {
+	stop();
+}
+
+void cThreadPool::start(int threads) {
+	stop();
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	std::vector<cQueue>(threads).swap(queues);
+	bStop = false;
+	for (int i = 0; i < threads - 1; i++) {
+		workers.push_back(std::thread(&cThreadPool::run, this, i));
+	}
+}
+
+void cThreadPool::stop() {
+	std::lock_guard<std::mutex> caller(callmutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bStop = true;
+	}
+	wakeup.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	workers.clear();
+	std::vector<cQueue>(1).swap(queues);
+}
+
+// take an iteration from our own queue, or steal one from another
+bool cThreadPool::getTask(int index, int &i) {
+	int n = (int)queues.size();
+	{
+		cQueue &q = queues[index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.front < q.back) {
+			i = q.front++;
+			return true;
+		}
+	}
+	for (int k = 1; k < n; k++) {
+		cQueue &q = queues[(index + k) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.front < q.back) {
+			i = --q.back;
+			return true;
+		}
+	}
+	return false;
+}
+
+void cThreadPool::runTasks(int index) {
+	int i;
+	while (getTask(index, i)) {
+		try {
+			call(task, i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0) done.notify_all();
+	}
+}
+
+void cThreadPool::run(int index) {
+	unsigned int seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeup.wait(lock, [&] { return bStop || generation != seen; });
+			if (bStop) return;
+			seen = generation;
+		}
+		runTasks(index);
+	}
+}
+
+void cThreadPool::runLoop(int n, tCall call, const void *task) {
+	if (n <= 0) return;
+	std::lock_guard<std::mutex> caller(callmutex);
+	int threads = (int)queues.size();
+	this->call = call;
+	this->task = task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = n;
+		error = std::exception_ptr();
+	}
+	// neighboring iterations go to the same thread
+	for (int t = 0; t < threads; t++) {
+		cQueue &q = queues[t];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.front = (int)((long long)n * t / threads);
+		q.back = (int)((long long)n * (t + 1) / threads);
+	}
+	if (threads > 1) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+		}
+		wakeup.notify_all();
+	}
+	// the calling thread works too
+	runTasks(threads - 1);
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return pending == 0; });
+	this->call = 0;
+	this->task = 0;
+	if (error) {
+		std::exception_ptr e = error;
+		error = std::exception_ptr();
+		lock.unlock();
+		std::rethrow_exception(e);
+	}
+}
@@ -0,0 +1,67 @@
+// Work-stealing thread pool for data parallel loops.
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// Runs the iterations of a loop on a fixed set of threads. Each thread gets a
+// contiguous block of the iterations in its own queue and takes them from the
+// front; a thread that runs out steals from the back of the others' queues, so
+// uneven iterations are balanced without a central queue.
+class cThreadPool {
+public:
+	//! Constructor.
+	cThreadPool();
+	//! Destructor.
+	~cThreadPool();
+	// start the given number of threads (including the calling thread), 0 = one per core
+	void start(int threads = 0);
+	// stop the threads; loops are run on the calling thread alone afterwards
+	void stop();
+	// number of threads loops are run on
+	int size() const {
+		return (int)workers.size() + 1;
+	}
+	// call task(i) for 0 <= i < n on all threads, and wait for all of them.
+	// Loops of different callers are run one after the other; tasks must not start loops themselves.
+	// The task is called through a pointer, so a loop allocates nothing.
+	template <class F>
+	void parallelFor(int n, const F &task) {
+		runLoop(n, &callTask<F>, &task);
+	}
+private:
+	typedef void (*tCall)(const void *task, int i);
+	template <class F>
+	static void callTask(const void *task, int i) {
+		(*(const F*)task)(i);
+	}
+	// iterations front <= i < back of a thread
+	struct cQueue {
+		std::mutex mutex;
+		int front, back;
+		cQueue() :front(0), back(0) {}
+	};
+	void runLoop(int n, tCall call, const void *task);
+	void run(int index);
+	bool getTask(int index, int &i);
+	void runTasks(int index);
+	std::vector<std::thread> workers;
+	std::vector<cQueue> queues;		// one for each thread, the calling thread is the last
+	tCall call;						// calls the task of the current loop
+	const void *task;
+	int pending;					// iterations of the current loop not finished yet
+	unsigned int generation;		// incremented for each loop
+	bool bStop;
+	std::exception_ptr error;		// first exception thrown by a task
+	std::mutex mutex;				// guards the loop state
+	std::mutex callmutex;			// one loop at a time
+	std::condition_variable wakeup;
+	std::condition_variable done;
+};
+
+#endif
@@ -0,0 +1,390 @@
+// Tile-parallel filtering and blob detection of whole frames.
+
+#include <algorithm>
+
+#include "TilePipeline.h"
+#include "HSVConvert.h"
+#include "Highlight.h"
+#include "Buffers.h"
+#include "StageTimer.h"
+#include "CpuFeatures.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// bytes of each pixel in flight in a tile: input, smoothed and HSV (3 each), mask
+const int TILE_PIXEL_BYTES = 10;
+// sizes of the region buffers are rounded up to this many pixels
+const int REGION_STEP = 16;
+
+// index of a pixel outside of a row or column of n pixels (BORDER_REFLECT_101)
+static int reflect101(int i, int n) {
+	if (n == 1) return 0;
+	if (i < 0) return -i;
+	if (i >= n) return 2 * n - 2 - i;
+	return i;
+}
+
+// [1 2 1] sums of the bytes of a row with the same channel of the pixels on both sides,
+// for the bytes from i to end; the SIMD versions return where they stopped
+static void sumBytesScalar(const uchar *s, ushort *h, int i, int end) {
+	for (; i < end; i++) {
+		h[i] = (ushort)(s[i - 3] + 2 * s[i] + s[i + 3]);
+	}
+}
+
+// rounded [1 2 1] / 16 of three rows of sums into bytes, for the bytes from i to end
+static void averageRowsScalar(const ushort *a, const ushort *b, const ushort *c, uchar *d, int i, int end) {
+	for (; i < end; i++) {
+		d[i] = (uchar)((a[i] + 2 * b[i] + c[i] + 8) >> 4);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+static int sumBytesSSE2(const uchar *s, ushort *h, int i, int end) {
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= end; i += 16) {
+		__m128i l = _mm_loadu_si128((const __m128i *)(s + i - 3));
+		__m128i m = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i r = _mm_loadu_si128((const __m128i *)(s + i + 3));
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero)),
+			_mm_slli_epi16(_mm_unpacklo_epi8(m, zero), 1));
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero)),
+			_mm_slli_epi16(_mm_unpackhi_epi8(m, zero), 1));
+		_mm_storeu_si128((__m128i *)(h + i), lo);
+		_mm_storeu_si128((__m128i *)(h + i + 8), hi);
+	}
+	return i;
+}
+
+static int averageRowsSSE2(const ushort *a, const ushort *b, const ushort *c, uchar *d, int i, int end) {
+	__m128i eight = _mm_set1_epi16(8);
+	for (; i + 16 <= end; i += 16) {
+		__m128i v[2];
+		for (int k = 0; k < 2; k++) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + i + 8 * k));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + i + 8 * k));
+			__m128i vc = _mm_loadu_si128((const __m128i *)(c + i + 8 * k));
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(va, vc), _mm_add_epi16(_mm_slli_epi16(vb, 1), eight));
+			v[k] = _mm_srli_epi16(sum, 4);
+		}
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(v[0], v[1]));
+	}
+	return i;
+}
+
+TARGET_AVX2
+static int sumBytesAVX2(const uchar *s, ushort *h, int i, int end) {
+	for (; i + 16 <= end; i += 16) {
+		__m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + i - 3)));
+		__m256i m = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + i)));
+		__m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + i + 3)));
+		_mm256_storeu_si256((__m256i *)(h + i), _mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_slli_epi16(m, 1)));
+	}
+	return i;
+}
+
+TARGET_AVX2
+static int averageRowsAVX2(const ushort *a, const ushort *b, const ushort *c, uchar *d, int i, int end) {
+	__m256i eight = _mm256_set1_epi16(8);
+	for (; i + 32 <= end; i += 32) {
+		__m256i v[2];
+		for (int k = 0; k < 2; k++) {
+			__m256i va = _mm256_loadu_si256((const __m256i *)(a + i + 16 * k));
+			__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i + 16 * k));
+			__m256i vc = _mm256_loadu_si256((const __m256i *)(c + i + 16 * k));
+			__m256i sum = _mm256_add_epi16(_mm256_add_epi16(va, vc), _mm256_add_epi16(_mm256_slli_epi16(vb, 1), eight));
+			v[k] = _mm256_srli_epi16(sum, 4);
+		}
+		// packing works within 128-bit lanes, put the quarters back in order
+		__m256i packed = _mm256_packus_epi16(v[0], v[1]);
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return i;
+}
+
+#endif
+
+// [1 2 1] sums of the three channels of each pixel of a row; left and right are the
+// offsets of the pixels before the first and after the last one (in pixels)
+static void sumRow(const uchar *s, ushort *h, int cols, int left, int right, int level) {
+	int n = cols * 3;
+	int next = cols > 1 ? 1 : right;
+	for (int c = 0; c < 3; c++) {
+		h[c] = (ushort)(s[left * 3 + c] + 2 * s[c] + s[next * 3 + c]);
+	}
+	int i = 3;
+#ifdef HAVE_X86_SIMD
+	if (level >= SIMD_AVX2) i = sumBytesAVX2(s, h, i, n - 3);
+	else if (level >= SIMD_SSE2) i = sumBytesSSE2(s, h, i, n - 3);
+#endif
+	sumBytesScalar(s, h, i, n - 3);
+	if (cols > 1) {
+		for (int c = 0; c < 3; c++) {
+			int i = n - 3 + c;
+			h[i] = (ushort)(s[i - 3] + 2 * s[i] + s[right * 3 + c]);
+		}
+	}
+}
+
+void smoothFrame(const cv::Mat &src, cv::Mat &dst, cv::Mat &rowbuffer) {
+	CV_Assert(src.type() == CV_8UC3);
+	int rows = src.rows, cols = src.cols;
+	dst.create(src.size(), CV_8UC3);
+	if (!rows || !cols) return;
+	// pixels around a submatrix are read from its parent, the border of the parent is mirrored
+	cv::Size whole;
+	cv::Point ofs;
+	src.locateROI(whole, ofs);
+	int left = reflect101(ofs.x - 1, whole.width) - ofs.x;
+	int right = reflect101(ofs.x + cols, whole.width) - ofs.x;
+	int above = reflect101(ofs.y - 1, whole.height) - ofs.y;
+	int below = reflect101(ofs.y + rows, whole.height) - ofs.y;
+	int level = getSIMDLevel();
+	// horizontal sums of three rows in turn (at most 4 * 255, 16 bits are enough)
+	cv::Mat sums = getScratch(rowbuffer, 3, cols, CV_16UC3);
+	ushort *h[3] = { sums.ptr<ushort>(0), sums.ptr<ushort>(1), sums.ptr<ushort>(2) };
+	sumRow(src.data + (ptrdiff_t)above * (ptrdiff_t)src.step, h[0], cols, left, right, level);
+	sumRow(src.ptr<uchar>(0), h[1], cols, left, right, level);
+	int n = cols * 3;
+	for (int y = 0; y < rows; y++) {
+		const ushort *a = h[y % 3];
+		const ushort *b = h[(y + 1) % 3];
+		const ushort *c = h[(y + 2) % 3];
+		if (y + 1 < rows) {
+			sumRow(src.ptr<uchar>(y + 1), h[(y + 2) % 3], cols, left, right, level);
+		} else if (below < rows) {
+			// the mirrored row is in the image: reuse its sums, it may already be
+			// overwritten if dst is src
+			c = below == y ? b : a;
+		} else {
+			sumRow(src.data + (ptrdiff_t)below * (ptrdiff_t)src.step, h[(y + 2) % 3], cols, left, right, level);
+		}
+		// vertical [1 2 1] with the rounding of cv::GaussianBlur for 8-bit images
+		uchar *d = dst.ptr<uchar>(y);
+		int i = 0;
+#ifdef HAVE_X86_SIMD
+		if (level >= SIMD_AVX2) i = averageRowsAVX2(a, b, c, d, i, n);
+		else if (level >= SIMD_SSE2) i = averageRowsSSE2(a, b, c, d, i, n);
+#endif
+		averageRowsScalar(a, b, c, d, i, n);
+	}
+}
+
+void smoothFrame(const cv::Mat &src, cv::Mat &dst) {
+	cv::Mat rowbuffer;
+	smoothFrame(src, dst, rowbuffer);
+}
+
+void smoothFrameHSV(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstHSV, cv::Mat &rowbuffer) {
+	CV_Assert(src.type() == CV_8UC3);
+	dst.create(src.size(), CV_8UC3);
+	dstHSV.create(src.size(), CV_8UC3);
+	CV_Assert(dst.data != src.data); // bands read the unblurred rows around them
+	int rows = cTilePipeline::getBandRows(src.cols, src.rows);
+	for (int y0 = 0; y0 < src.rows; y0 += rows) {
+		int y1 = std::min(y0 + rows, src.rows);
+		cv::Mat smoothed = dst.rowRange(y0, y1);
+		cv::Mat hsv = dstHSV.rowRange(y0, y1);
+		smoothFrame(src.rowRange(y0, y1), smoothed, rowbuffer);
+		convertBGRToHSV(smoothed, hsv);
+	}
+}
+
+cTilePipeline::cTilePipeline(cThreadPool &pool)
+	:bSmooth(false), bKeepSmoothed(true), lookuptable(0), iHighlightChannel(-1), iBlobMode(BLOBS_NONE), minArea(0)
+	,cancel(0)
+	,pool(pool)
+{}
+
+int cTilePipeline::getBandRows(int width, int height) {
+	int rows = TILE_BYTES / (TILE_PIXEL_BYTES * (width > 0 ? width : 1));
+	if (rows < 8) rows = 8;
+	if (rows > height) rows = height;
+	return rows;
+}
+
+bool cTilePipeline::process(const cv::Mat &srcBGR, const cv::Mat &srcHSV, const cColor &color,
+	cv::Mat &dstSmoothed, cv::Mat &dstBin, cv::Mat &dstHighlight, std::vector<cBlob> &blobs)
+{
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	int rows = getBandRows(srcBGR.cols, srcBGR.rows);
+	int n = rows ? (srcBGR.rows + rows - 1) / rows : 0;
+	cHSVLimits limits(color);
+
+	// outputs are allocated up front, bands write into their parts
+	if (bSmooth && bKeepSmoothed) {
+		dstSmoothed.create(srcBGR.size(), CV_8UC3);
+		CV_Assert(dstSmoothed.data != srcBGR.data); // bands read the unblurred rows around them
+	}
+	dstBin.create(srcBGR.size(), CV_8UC1);
+	if (iHighlightChannel >= 0) dstHighlight.create(srcBGR.size(), CV_8UC3);
+	if ((int)tiles.size() < n) tiles.resize(n);
+	bands.resize(n);
+
+	pool.parallelFor(n, [&](int i) {
+		if (cancel && *cancel) return;
+		cTile &tile = tiles[i];
+		int y0 = i * rows;
+		int y1 = std::min(y0 + rows, srcBGR.rows);
+		cv::Mat bgr = srcBGR.rowRange(y0, y1);
+		cv::Mat mask = dstBin.rowRange(y0, y1);
+		cv::Mat smoothed;
+		if (bSmooth) {
+			// blurred bands that are not kept are only read back from the cache
+			smoothed = bKeepSmoothed ? dstSmoothed.rowRange(y0, y1) : getScratch(tile.smoothed, y1 - y0, srcBGR.cols, CV_8UC3);
+		}
+		filterTile(bgr, srcHSV.empty() ? srcHSV : srcHSV.rowRange(y0, y1), smoothed, mask, limits, tile.rowbuffer);
+		if (iHighlightChannel >= 0) {
+			STAGE_TIMER("tile.highlight");
+			cv::Mat highlight = dstHighlight.rowRange(y0, y1);
+			HighlightMask(bgr, mask, highlight, iHighlightChannel);
+		}
+		STAGE_TIMER("tile.blobs");
+		tile.extractor.extractBand(mask, y0, bands[i], iBlobMode, minArea);
+	});
+	if (cancel && *cancel) return false;
+
+	STAGE_TIMER("blobs.merge");
+	merger.merge(bands, blobs, iBlobMode, minArea);
+	return true;
+}
+
+void cTilePipeline::processRegions(const cv::Mat &srcBGR, const cColor &color,
+	const std::vector<cv::Rect> &rects, std::vector<std::vector<cBlob> > &blobs)
+{
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	int n = (int)rects.size();
+	cHSVLimits limits(color);
+	if ((int)tiles.size() < n) tiles.resize(n);
+	// vectors of regions are kept for later frames, with the memory of their blobs
+	if ((int)blobs.size() < n) blobs.resize(n);
+	// the largest regions go to the first tiles, so the buffers of each tile see regions
+	// of about the same size from frame to frame, and the largest ones start first
+	order.resize(n);
+	for (int i = 0; i < n; i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		return rects[a].area() > rects[b].area() || (rects[a].area() == rects[b].area() && a < b);
+	});
+
+	pool.parallelFor(n, [&](int k) {
+		cTile &tile = tiles[k];
+		int i = order[k];
+		const cv::Rect &r = rects[i];
+		cv::Mat bgr = srcBGR(r);
+		// regions change size from frame to frame, their buffers only grow, and in steps so
+		// that they stop growing after a few frames
+		int rows = (r.height + REGION_STEP - 1) / REGION_STEP * REGION_STEP;
+		int cols = (r.width + REGION_STEP - 1) / REGION_STEP * REGION_STEP;
+		cv::Rect used(0, 0, r.width, r.height);
+		cv::Mat mask = getScratch(tile.mask, rows, cols, CV_8UC1)(used);
+		cv::Mat smoothed = bSmooth ? getScratch(tile.smoothed, rows, cols, CV_8UC3)(used) : cv::Mat();
+		if (bSmooth) getScratch(tile.rowbuffer, 3, cols, CV_16UC3);
+		filterTile(bgr, cv::Mat(), smoothed, mask, limits, tile.rowbuffer);
+		STAGE_TIMER("tile.blobs");
+		tile.extractor.extract(mask, blobs[i], BLOBS_ALL, minArea);
+		// back to frame coordinates, central moments do not change
+		for (size_t j = 0; j < blobs[i].size(); j++) {
+			blobs[i][j].x += r.x;
+			blobs[i][j].y += r.y;
+			blobs[i][j].bbox.x += r.x;
+			blobs[i][j].bbox.y += r.y;
+		}
+	});
+	// any vector can get the blobs of the largest region next time, so they grow together
+	size_t capacity = 0;
+	for (int i = 0; i < n; i++) capacity = std::max(capacity, blobs[i].capacity());
+	for (int i = 0; i < n; i++) blobs[i].reserve(capacity);
+}
+
+bool cTilePipeline::processWindows(const cv::Mat &srcBGR, const cColor &color, std::vector<cv::Rect> &windows,
+	int margin, std::vector<cBlob> &blobs)
+{
+	cv::Rect frame(0, 0, srcBGR.cols, srcBGR.rows);
+	for (int round = 0; round < WINDOW_ROUNDS; round++) {
+		mergeWindows(windows);
+		processRegions(srcBGR, color, windows, windowblobs);
+		bool bCut = false;
+		for (size_t i = 0; i < windows.size(); i++) {
+			cv::Rect &w = windows[i];
+			for (size_t j = 0; j < windowblobs[i].size(); j++) {
+				const cv::Rect &b = windowblobs[i][j].bbox;
+				if ((b.x == w.x && w.x > 0) || (b.y == w.y && w.y > 0) ||
+					(b.x + b.width == w.x + w.width && w.x + w.width < frame.width) ||
+					(b.y + b.height == w.y + w.height && w.y + w.height < frame.height))
+				{
+					w |= cv::Rect(b.x - margin, b.y - margin, b.width + 2 * margin, b.height + 2 * margin) & frame;
+					bCut = true;
+				}
+			}
+		}
+		if (!bCut) {
+			blobs.clear();
+			for (size_t i = 0; i < windows.size(); i++) {
+				blobs.insert(blobs.end(), windowblobs[i].begin(), windowblobs[i].end());
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void mergeWindows(std::vector<cv::Rect> &windows) {
+	for (size_t i = 0; i < windows.size(); i++) {
+		for (size_t j = i + 1; j < windows.size(); j++) {
+			if ((windows[i] & windows[j]).area() > 0) {
+				windows[i] |= windows[j];
+				windows.erase(windows.begin() + j);
+				j = i; // the grown window may overlap earlier ones
+			}
+		}
+	}
+	// drop windows outside of the frame
+	for (size_t i = windows.size(); i-- > 0; ) {
+		if (windows[i].area() <= 0) windows.erase(windows.begin() + i);
+	}
+}
+
+void cTilePipeline::filterTile(cv::Mat &bgr, const cv::Mat &srcHSV, cv::Mat &smoothed,
+	cv::Mat &mask, const cHSVLimits &limits, cv::Mat &rowbuffer)
+{
+	// blurring a part of a frame reads the pixels around it, so the result is the same
+	if (bSmooth) {
+		STAGE_TIMER("tile.blur");
+		smoothFrame(bgr, smoothed, rowbuffer);
+		bgr = smoothed;
+	}
+	if (lookuptable) {
+		STAGE_TIMER("tile.lookuptable");
+		lookuptable->filter(mask, bgr);
+		return;
+	}
+	// without an HSV frame, each row is converted and thresholded in registers
+	if (srcHSV.empty()) {
+		STAGE_TIMER("tile.bgrfilter");
+		for (int y = 0; y < bgr.rows; y++) {
+			filterBGRRow(mask.ptr<uchar>(y), bgr.ptr<uchar>(y), bgr.cols, limits);
+		}
+		return;
+	}
+	STAGE_TIMER("tile.threshold");
+	for (int y = 0; y < srcHSV.rows; y++) {
+		filterHSVRow(mask.ptr<uchar>(y), srcHSV.ptr<uchar>(y), srcHSV.cols, limits);
+	}
+}
+
+void cTilePipeline::convert(const cv::Mat &srcBGR, cv::Mat &dstHSV) {
+	CV_Assert(srcBGR.type() == CV_8UC3);
+	int rows = getBandRows(srcBGR.cols, srcBGR.rows);
+	int n = rows ? (srcBGR.rows + rows - 1) / rows : 0;
+	dstHSV.create(srcBGR.size(), CV_8UC3);
+	pool.parallelFor(n, [&](int i) {
+		STAGE_TIMER("tile.cvtColor");
+		int y0 = i * rows;
+		int y1 = std::min(y0 + rows, srcBGR.rows);
+		cv::Mat hsv = dstHSV.rowRange(y0, y1);
+		convertBGRToHSV(srcBGR.rowRange(y0, y1), hsv);
+	});
+}
@@ -0,0 +1,94 @@
+// Tile-parallel filtering and blob detection of whole frames.
+
+#ifndef TILEPIPELINE_H
+#define TILEPIPELINE_H
+
+#include <vector>
+#include <atomic>
+
+// Include OpenCV libraries
+#include <opencv2/opencv.hpp>
+
+#include "HSVFilter.h"
+#include "Blobs.h"
+#include "ThreadPool.h"
+
+const int TILE_BYTES = 256 * 1024; // working set of a tile, about the size of a L2 cache
+const int WINDOW_ROUNDS = 3; // times windows are grown around cut blobs before giving up
+
+// Gaussian smoothing of input image to reduce speckle/interlace noise: a 3x3 blur of [1 2 1]/4
+// in both directions, with the rounding and the border (BORDER_REFLECT_101) of cv::GaussianBlur.
+// Like OpenCV, pixels around a submatrix are read from its parent. rowbuffer holds the 16-bit
+// sums of three rows; it only grows, so nothing is allocated once it fits. dst may be src.
+void smoothFrame(const cv::Mat &src, cv::Mat &dst, cv::Mat &rowbuffer);
+// the same with a row buffer of its own, for frames that are blurred once
+void smoothFrame(const cv::Mat &src, cv::Mat &dst);
+
+// Smooth a frame like smoothFrame() and convert the result to HSV in the same pass:
+// the frame is done in bands of rows small enough to stay in cache, so each blurred
+// band is converted before it is written back to memory. dst must not be src.
+void smoothFrameHSV(const cv::Mat &src, cv::Mat &dst, cv::Mat &dstHSV, cv::Mat &rowbuffer);
+
+// Processes a frame in bands of rows sized to stay in cache. Each band goes through
+// all steps (blur, HSV conversion, thresholding, highlighting, blob statistics) before
+// the next one is started, and the bands are distributed over the threads of a pool.
+// Blobs crossing bands are joined at the end. The results are the same as those of
+// running each step on the whole frame on a single thread.
+class cTilePipeline {
+public:
+	bool bSmooth;			// blur the input with smoothFrame() first
+	bool bKeepSmoothed;		// write the blurred frame to dstSmoothed of process(), otherwise
+							// each band is blurred into a buffer that stays in cache
+	const cHSVLookupTable *lookuptable;	// threshold BGR with this table instead of HSV, if set
+	int iHighlightChannel;	// compose the highlight image with this channel (see HighlightMask()), -1 = off
+	int iBlobMode;			// BLOBS_NONE, BLOBS_LARGEST or BLOBS_ALL
+	int minArea;			// minimum blob area
+	const std::atomic<bool> *cancel;	// no more bands are started once this is set, if given
+	//! Constructor.
+	explicit cTilePipeline(cThreadPool &pool);
+	// Filter a BGR frame with a color. srcHSV is the HSV version of the (smoothed) frame,
+	// or empty to convert it band by band. dstSmoothed gets the blurred frame if bSmooth
+	// and bKeepSmoothed are set, dstHighlight the highlight image if iHighlightChannel >= 0.
+	// Returns false if it was canceled, the outputs are incomplete then.
+	bool process(const cv::Mat &srcBGR, const cv::Mat &srcHSV, const cColor &color,
+		cv::Mat &dstSmoothed, cv::Mat &dstBin, cv::Mat &dstHighlight, std::vector<cBlob> &blobs);
+	// Filter only some regions of a frame and find the blobs in each of them, one region
+	// per thread. blobs[i] gets the blobs of rects[i] in frame coordinates; blobs reaching
+	// the border of a region may continue outside of it. Highlighting is not done.
+	// blobs is not shrunk, it may have more vectors than rects (with stale blobs).
+	void processRegions(const cv::Mat &srcBGR, const cColor &color, const std::vector<cv::Rect> &rects,
+		std::vector<std::vector<cBlob> > &blobs);
+	// Filter search windows with processRegions(), after joining the overlapping ones. Windows
+	// are grown by margin around blobs cut by their border (not the frame border) and filtered
+	// again, at most WINDOW_ROUNDS times; blobs gets the blobs of all windows. Returns false if
+	// blobs are still cut after that, then blobs is not set.
+	bool processWindows(const cv::Mat &srcBGR, const cColor &color, std::vector<cv::Rect> &windows,
+		int margin, std::vector<cBlob> &blobs);
+	// convert a BGR frame to HSV on all threads
+	void convert(const cv::Mat &srcBGR, cv::Mat &dstHSV);
+	// number of rows in a band for a frame width
+	static int getBandRows(int width, int height);
+private:
+	class cTile {
+	public:
+		cv::Mat smoothed;		// blurred region or band, if not kept (see getScratch())
+		cv::Mat mask;			// filtered region,		"
+		cv::Mat rowbuffer;		// row sums of the blur
+		cBlobExtractor extractor;
+	};
+	// blur and threshold a part of a frame, bgr is replaced with its blurred version
+	void filterTile(cv::Mat &bgr, const cv::Mat &srcHSV, cv::Mat &smoothed,
+		cv::Mat &mask, const cHSVLimits &limits, cv::Mat &rowbuffer);
+	cThreadPool &pool;
+	std::vector<cTile> tiles;
+	std::vector<cBlobBand> bands;
+	cBlobMerger merger;
+	std::vector<std::vector<cBlob> > windowblobs;	// blobs of each window in processWindows()
+	std::vector<int> order;		// regions by decreasing area in processRegions()
+};
+
+// join overlapping windows, so that every pixel is labeled only once; windows outside
+// of the frame (empty) are dropped
+void mergeWindows(std::vector<cv::Rect> &windows);
+
+#endif